@@ -0,0 +1,104 @@
+// Compares building and tearing down a large linked structure with
+// per-object malloc/free against doing the same in a lib211 arena,
+// both with no allocation limit and under a peak limit.
+
+#define _XOPEN_SOURCE 700
+
+#include <211.h>
+#include <211_alloc_limit.h>
+#include <211_arena.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NODES   1000000
+#define ROUNDS  5
+
+struct node
+{
+    struct node* next;
+    long         value[3];
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double measure_malloc(void)
+{
+    double start = now_ns();
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        struct node* head = NULL;
+
+        for (long i = 0; i < NODES; ++i) {
+            struct node* n = malloc(sizeof *n);
+            if (!n) {
+                perror("malloc");
+                exit(1);
+            }
+            n->next     = head;
+            n->value[0] = i;
+            head        = n;
+        }
+
+        while (head) {
+            struct node* next = head->next;
+            free(head);
+            head = next;
+        }
+    }
+
+    return (now_ns() - start) / ((double) ROUNDS * NODES);
+}
+
+static double measure_arena(void)
+{
+    double start = now_ns();
+
+    struct lib211_arena* arena = lib211_arena_create(0);
+    if (!arena) {
+        perror("lib211_arena_create");
+        exit(1);
+    }
+
+    struct lib211_arena_mark empty = lib211_arena_mark(arena);
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        struct node* head = NULL;
+
+        for (long i = 0; i < NODES; ++i) {
+            struct node* n = lib211_arena_alloc(arena, sizeof *n);
+            if (!n) {
+                perror("lib211_arena_alloc");
+                exit(1);
+            }
+            n->next     = head;
+            n->value[0] = i;
+            head        = n;
+        }
+
+        lib211_arena_reset(arena, empty);
+    }
+
+    lib211_arena_destroy(arena);
+
+    return (now_ns() - start) / ((double) ROUNDS * NODES);
+}
+
+int main(void)
+{
+    printf("%-12s  %16s  %16s\n", "limit", "malloc ns/node", "arena ns/node");
+
+    alloc_limit_set_no_limit();
+    printf("%-12s  %16.1f  %16.1f\n", "none", measure_malloc(), measure_arena());
+
+    alloc_limit_set_peak((size_t) 1 << 30);
+    printf("%-12s  %16.1f  %16.1f\n", "peak", measure_malloc(), measure_arena());
+
+    alloc_limit_set_no_limit();
+}
@@ -0,0 +1,67 @@
+// Measures what the allocation wrappers add to a malloc/free pair in
+// each limit state, compared to calling the C library directly. With
+// no limit (and no tracing), the wrappers should cost little more than
+// one indirect call and the alloc_stats_get(3) counters.
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+
+// These are compiled before <211.h> renames malloc and free.
+static void* libc_malloc(size_t n) { return malloc(n); }
+static void  libc_free(void* p)    { free(p); }
+
+#include <211.h>
+#include <211_alloc_limit.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define OPERATIONS  10000000
+#define BLOCK_SIZE  32
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Returns the average nanoseconds per malloc/free pair, calling through
+// the given functions.
+static double measure(void* (*alloc)(size_t), void (*release)(void*))
+{
+    double start = now_ns();
+
+    for (size_t n = 0; n < OPERATIONS; ++n) {
+        void* volatile p = alloc(BLOCK_SIZE);
+        release(p);
+    }
+
+    return (now_ns() - start) / OPERATIONS;
+}
+
+static void report(char const* name, double ns, double base)
+{
+    printf("%-18s  %10.1f  %+10.1f\n", name, ns, ns - base);
+}
+
+int main(void)
+{
+    printf("%-18s  %10s  %10s\n", "configuration", "ns/pair", "overhead");
+
+    double base = measure(&libc_malloc, &libc_free);
+    report("C library", base, base);
+
+    alloc_limit_set_no_limit();
+    report("no limit", measure(&rt211_malloc, &rt211_free), base);
+
+    alloc_limit_set_total(SIZE_MAX / 2);
+    report("total limit", measure(&rt211_malloc, &rt211_free), base);
+
+    alloc_limit_set_peak(SIZE_MAX / 2);
+    report("peak limit", measure(&rt211_malloc, &rt211_free), base);
+
+    alloc_limit_set_no_limit();
+}
@@ -0,0 +1,64 @@
+// Measures the cost of free(3) and malloc(3) under a peak allocation
+// limit as the number of live allocations grows. The per-operation time
+// should stay flat from 10 to 10^6 live blocks.
+
+#define _XOPEN_SOURCE 700
+
+#include <211.h>
+#include <211_alloc_limit.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BLOCK_SIZE  16
+#define OPERATIONS  1000000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Allocates `live` blocks, then repeatedly frees a random one and
+// replaces it. Returns the average nanoseconds per free/malloc pair.
+static double measure(size_t live)
+{
+    void** blocks = malloc(live * sizeof *blocks);
+    if (!blocks) {
+        perror("malloc");
+        exit(1);
+    }
+
+    alloc_limit_set_peak((live + 1) * BLOCK_SIZE);
+
+    for (size_t i = 0; i < live; ++i)
+        blocks[i] = malloc(BLOCK_SIZE);
+
+    double start = now_ns();
+
+    for (size_t n = 0; n < OPERATIONS; ++n) {
+        size_t i = (size_t) rand() % live;
+        free(blocks[i]);
+        blocks[i] = malloc(BLOCK_SIZE);
+    }
+
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < live; ++i)
+        free(blocks[i]);
+
+    alloc_limit_set_no_limit();
+    free(blocks);
+
+    return elapsed / OPERATIONS;
+}
+
+int main(void)
+{
+    printf("%12s  %14s\n", "live blocks", "ns/free+malloc");
+
+    for (size_t live = 10; live <= 1000000; live *= 10)
+        printf("%12zu  %14.1f\n", live, measure(live));
+}
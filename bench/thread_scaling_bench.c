@@ -0,0 +1,84 @@
+// Measures malloc/free throughput under a total and a peak allocation
+// limit as the number of threads grows. Ideally, throughput per thread
+// stays roughly constant up to the number of cores.
+
+#define _XOPEN_SOURCE 700
+
+#include <211.h>
+#include <211_alloc_limit.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS     32
+#define OPS_PER_THREAD  1000000
+#define WINDOW          64
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void* worker(void* arg)
+{
+    unsigned seed = (unsigned) (size_t) arg;
+    void* blocks[WINDOW] = {0};
+
+    for (size_t n = 0; n < OPS_PER_THREAD; ++n) {
+        size_t i = n % WINDOW;
+        free(blocks[i]);
+        blocks[i] = malloc(16 + rand_r(&seed) % 256);
+    }
+
+    for (size_t i = 0; i < WINDOW; ++i)
+        free(blocks[i]);
+
+    return NULL;
+}
+
+// Returns millions of malloc/free pairs per second.
+static double measure(size_t nthreads)
+{
+    pthread_t threads[MAX_THREADS];
+
+    double start = now_ns();
+
+    for (size_t i = 0; i < nthreads; ++i)
+        pthread_create(&threads[i], NULL, &worker, (void*) (i + 1));
+
+    for (size_t i = 0; i < nthreads; ++i)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = now_ns() - start;
+
+    return nthreads * OPS_PER_THREAD / elapsed * 1e3;
+}
+
+static void run(char const* label, void (*set_limit)(size_t))
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("\n%s (%ld cores)\n%8s  %12s\n", label, cores, "threads", "Mops/s");
+
+    for (size_t nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        set_limit((size_t) 1 << 40);
+        printf("%8zu  %12.2f\n", nthreads, measure(nthreads));
+    }
+}
+
+static void set_no_limit(size_t n)
+{
+    (void) n;
+    alloc_limit_set_no_limit();
+}
+
+int main(void)
+{
+    run("no limit", &set_no_limit);
+    run("total limit", &alloc_limit_set_total);
+    run("peak limit", &alloc_limit_set_peak);
+}
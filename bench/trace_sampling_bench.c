@@ -0,0 +1,109 @@
+// Measures the per-call cost of tracing with and without sampling. Each
+// configuration runs in a fresh copy of this program, since tracing is
+// configured from the environment once per process. Traces go to
+// /dev/null in the binary format, so we time the encoding, not the disk.
+
+#define _XOPEN_SOURCE 700
+
+#include <211.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPERATIONS  2000000
+#define WINDOW      64
+
+static struct config
+{
+    char const* name;
+    char const* var;        // sampling variable to set, if any
+    char const* value;
+    int         trace;      // whether to trace at all
+} const configs[] = {
+    { "no tracing",           NULL,                       NULL,      0 },
+    { "full trace",           NULL,                       NULL,      1 },
+    { "every 100th",          "RT211_TRACE_EVERY",        "100",     1 },
+    { "every 10000th",        "RT211_TRACE_EVERY",        "10000",   1 },
+    { "1 per 64 KiB",         "RT211_TRACE_SAMPLE_BYTES", "64K",     1 },
+    { "1 per 1 MiB",          "RT211_TRACE_SAMPLE_BYTES", "1M",      1 },
+    { "sizes 2048-",          "RT211_TRACE_SIZES",        "2048-",   1 },
+};
+
+#define NCONFIGS  (sizeof configs / sizeof *configs)
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Returns the average nanoseconds per malloc or free.
+static double measure(void)
+{
+    void*    blocks[WINDOW] = {0};
+    unsigned seed = 1;
+
+    double start = now_ns();
+
+    for (size_t n = 0; n < OPERATIONS / 2; ++n) {
+        size_t i = (size_t) rand_r(&seed) % WINDOW;
+        free(blocks[i]);
+        blocks[i] = malloc((size_t) rand_r(&seed) % 4096 + 1);
+    }
+
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < WINDOW; ++i)
+        free(blocks[i]);
+
+    return elapsed / OPERATIONS;
+}
+
+static void run_config(char const* self, size_t index)
+{
+    struct config const* cfg = &configs[index];
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        if (cfg->trace) {
+            setenv("RT211_TRACE", "/dev/null", 1);
+            setenv("RT211_TRACE_FORMAT", "bin", 1);
+        }
+
+        if (cfg->var) setenv(cfg->var, cfg->value, 1);
+
+        char arg[16];
+        snprintf(arg, sizeof arg, "%zu", index);
+        execl(self, self, arg, (char*) NULL);
+        perror(self);
+        _exit(1);
+    }
+
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1) {
+        size_t index = strtoul(argv[1], NULL, 10);
+        printf("%-16s  %10.1f\n", configs[index].name, measure());
+        return 0;
+    }
+
+    printf("%-16s  %10s\n", "configuration", "ns/call");
+
+    for (size_t i = 0; i < NCONFIGS; ++i)
+        run_config(argv[0], i);
+}
@@ -10,3 +10,18 @@ void alloc_limit_set_peak(size_t n);
 
 // Limits subsequent gross allocations to `n` bytes total.
 void alloc_limit_set_total(size_t n);
+
+// The kinds of limit that alloc_limit_push() can add.
+enum alloc_limit_kind
+{
+    ALLOC_LIMIT_PEAK,
+    ALLOC_LIMIT_TOTAL,
+};
+
+// Until the matching alloc_limit_pop(), additionally limits net
+// (ALLOC_LIMIT_PEAK) or gross (ALLOC_LIMIT_TOTAL) allocations to `n`
+// bytes. Limits nest: an allocation must fit in all of them.
+void alloc_limit_push(enum alloc_limit_kind kind, size_t n);
+
+// Removes the innermost limit added by alloc_limit_push().
+void alloc_limit_pop(void);
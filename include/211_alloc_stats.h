@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// What the allocation functions have done so far.
+struct alloc_stats
+{
+    size_t current_bytes;   // allocated and not yet freed
+    size_t peak_bytes;      // the most `current_bytes` has ever been
+    size_t total_bytes;     // allocated ever, whether freed or not
+
+    size_t malloc_calls;
+    size_t calloc_calls;
+    size_t realloc_calls;   // including reallocf
+    size_t free_calls;      // not counting free(NULL)
+};
+
+// Stores the current statistics in `*out`.
+void alloc_stats_get(struct alloc_stats* out);
+
+// Writes a pprof heap profile of the program so far to `out`. Returns
+// false, writing nothing, unless RT211_HEAP_PROFILE turned profiling on.
+bool alloc_profile_write(FILE* out);
+
+// A record of the heap at one point, for finding what a long-running
+// program allocates between two points and never frees.
+typedef struct alloc_snapshot alloc_snapshot_t;
+
+// Takes a snapshot, which costs about as much as a malloc. From the
+// first one on, every block allocated is tracked. Returns NULL if there
+// isn't memory for it.
+alloc_snapshot_t* alloc_snapshot_take(void);
+
+// Writes to `out` the blocks allocated after snapshot `a` but before
+// snapshot `b` (or now, if `b` is NULL) that are still live, grouped by
+// size and call site. Returns false if there wasn't memory to do so.
+bool alloc_snapshot_diff(alloc_snapshot_t const* a,
+                         alloc_snapshot_t const* b,
+                         FILE* out);
+
+// Frees a snapshot. Does nothing if `snapshot` is NULL.
+void alloc_snapshot_free(alloc_snapshot_t* snapshot);
+
+// The rest of this file is for lib211_alloc.h, which updates the
+// counters inline when LIB211_ALLOC_MODE is `stats`. Don't use it
+// directly.
+
+enum rt211_count_call
+{
+    RT211_COUNT_MALLOC,
+    RT211_COUNT_CALLOC,
+    RT211_COUNT_REALLOC,
+    RT211_COUNT_FREE,
+};
+
+struct rt211_alloc_counters
+{
+    _Atomic size_t current_bytes;
+    _Atomic size_t peak_bytes;
+    _Atomic size_t total_bytes;
+    _Atomic size_t calls[RT211_COUNT_FREE + 1];
+};
+
+extern struct rt211_alloc_counters rt211_alloc_counters;
+
+static inline void rt211_count_call(enum rt211_count_call which)
+{
+    atomic_fetch_add_explicit(&rt211_alloc_counters.calls[which], 1,
+                              memory_order_relaxed);
+}
+
+static inline void rt211_count_alloc(size_t n)
+{
+    struct rt211_alloc_counters* c = &rt211_alloc_counters;
+
+    atomic_fetch_add_explicit(&c->total_bytes, n, memory_order_relaxed);
+
+    size_t current = n + atomic_fetch_add_explicit(&c->current_bytes, n,
+                                                   memory_order_relaxed);
+    size_t peak    = atomic_load_explicit(&c->peak_bytes,
+                                          memory_order_relaxed);
+
+    while (current > peak &&
+           !atomic_compare_exchange_weak(&c->peak_bytes, &peak, current))
+    { }
+}
+
+static inline void rt211_count_free(size_t n)
+{
+    struct rt211_alloc_counters* c = &rt211_alloc_counters;
+    size_t current = atomic_load_explicit(&c->current_bytes,
+                                          memory_order_relaxed);
+
+    // A block may be freed by code in another LIB211_ALLOC_MODE, which
+    // counted it in a different size, so don't let it wrap around.
+    while (!atomic_compare_exchange_weak(&c->current_bytes, &current,
+                                         current > n ? current - n : 0))
+    { }
+}
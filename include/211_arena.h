@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+// An arena hands out memory by bumping a pointer through large chunks,
+// and frees it all at once. The chunks come from malloc(3) via lib211,
+// so allocation limits still apply, one chunk at a time.
+struct lib211_arena;
+
+// A position in an arena to reset back to.
+struct lib211_arena_mark
+{
+    void*  chunk;
+    size_t used;
+};
+
+// Creates an empty arena that allocates chunks of (at least)
+// `chunk_size` bytes, or a default size if `chunk_size` is 0. Returns
+// NULL if out of memory.
+struct lib211_arena* lib211_arena_create(size_t chunk_size);
+
+// Allocates `size` bytes from `arena`, aligned for any type. Returns
+// NULL if out of memory.
+void* lib211_arena_alloc(struct lib211_arena* arena, size_t size);
+
+// Remembers the current position of `arena`.
+struct lib211_arena_mark lib211_arena_mark(struct lib211_arena const* arena);
+
+// Frees everything allocated from `arena` since `mark` was taken.
+void lib211_arena_reset(struct lib211_arena* arena,
+                        struct lib211_arena_mark mark);
+
+// Frees `arena` and everything allocated from it.
+void lib211_arena_destroy(struct lib211_arena* arena);
@@ -3,34 +3,337 @@
 
 #include <stdlib.h>
 
-#undef malloc
-#undef calloc
-#undef realloc
-#undef reallocf
-#undef free
+// Defining LIB211_ALLOC_POSIX before including this header accounts for
+// strdup(3), strndup(3), getline(3) and getdelim(3) too, which means
+// also including <stdio.h>, <string.h> and <sys/types.h>. It's opt-in
+// so that the header doesn't take over those names (or drag in those
+// headers) in code that never asked for it.
+#ifdef LIB211_ALLOC_POSIX
+#  include <stdio.h>
+#  include <string.h>
+#  include <sys/types.h>
+#endif
+
+#undef rt211_malloc
+#undef rt211_calloc
+#undef rt211_realloc
+#undef rt211_reallocf
+#undef rt211_free
+#undef rt211_aligned_alloc
+#undef rt211_posix_memalign
+#undef rt211_strdup
+#undef rt211_strndup
+#undef rt211_getline
+#undef rt211_getdelim
 #undef read_line
 #undef fread_line
 #undef xread_line
 #undef prompt_line
 
-#ifndef LIB211_RAW_ALLOC
-#  define malloc       rt211_malloc
-#  define calloc       rt211_calloc
-#  define realloc      rt211_realloc
-#  define reallocf     rt211_reallocf
-#  define free         rt211_free
+// How much allocation instrumentation code compiled against this header
+// gets, chosen with -DLIB211_ALLOC_MODE=...:
+//
+//   full   Limits, statistics, tracing and the rest, with each call
+//          attributed to its call site. This is the default.
+//   limit  The same, but without call sites, so each call passes only
+//          its arguments.
+//   stats  Only the alloc_stats_get(3) counters, updated inline around
+//          direct calls to the C library. Limits don't apply.
+//   off    Nothing; malloc(3) and friends are the C library's.
+//
+// The library is the same in every mode, so code built in different
+// modes can be linked together. In `stats` and `off` modes, blocks
+// come straight from the C library, so they can only be passed to or
+// from code in other modes when lib211 keeps sizes in a side table
+// (the default), not in block headers.
+#ifndef LIB211_ALLOC_MODE
+#  define LIB211_ALLOC_MODE full
+#endif
+
+#define LIB211_ALLOC_MODE_full   1
+#define LIB211_ALLOC_MODE_limit  2
+#define LIB211_ALLOC_MODE_stats  3
+#define LIB211_ALLOC_MODE_off    4
+
+#define RT211_ALLOC_LEVEL_(M)    LIB211_ALLOC_MODE_##M
+#define RT211_ALLOC_LEVEL(M)     RT211_ALLOC_LEVEL_(M)
+
+#if RT211_ALLOC_LEVEL(LIB211_ALLOC_MODE) == 0
+#  error "LIB211_ALLOC_MODE must be full, limit, stats or off"
+#endif
+
+#if defined(LIB211_RAW_ALLOC)
+#  define read_line    read_line_raw_alloc
+#  define fread_line   fread_line_raw_alloc
+#  define xread_line   xread_line_raw_alloc
+#  define prompt_line  prompt_line_raw_alloc
+
+#elif RT211_ALLOC_LEVEL(LIB211_ALLOC_MODE) <= LIB211_ALLOC_MODE_limit
+#  undef  malloc
+#  undef  calloc
+#  undef  realloc
+#  undef  reallocf
+#  undef  free
+#  undef  aligned_alloc
+#  undef  posix_memalign
+#  define malloc          rt211_malloc
+#  define calloc          rt211_calloc
+#  define realloc         rt211_realloc
+#  define reallocf        rt211_reallocf
+#  define free            rt211_free
+#  define aligned_alloc   rt211_aligned_alloc
+#  define posix_memalign  rt211_posix_memalign
+
+#  ifdef LIB211_ALLOC_POSIX
+#    undef  strdup
+#    undef  strndup
+#    undef  getline
+#    undef  getdelim
+#    define strdup        rt211_strdup
+#    define strndup       rt211_strndup
+#    define getline       rt211_getline
+#    define getdelim      rt211_getdelim
+#  endif
+
+#  if RT211_ALLOC_LEVEL(LIB211_ALLOC_MODE) == LIB211_ALLOC_MODE_full
+// When called directly, pass along the call site too.
+#    define rt211_malloc(N)       rt211_malloc_at((N), __FILE__, __LINE__, __func__)
+#    define rt211_calloc(N, S)    rt211_calloc_at((N), (S), __FILE__, __LINE__, __func__)
+#    define rt211_realloc(P, N)   rt211_realloc_at((P), (N), __FILE__, __LINE__, __func__)
+#    define rt211_reallocf(P, N)  rt211_reallocf_at((P), (N), __FILE__, __LINE__, __func__)
+#    define rt211_free(P)         rt211_free_at((P), __FILE__, __LINE__, __func__)
+#    define rt211_aligned_alloc(A, N) \
+          rt211_aligned_alloc_at((A), (N), __FILE__, __LINE__, __func__)
+#    define rt211_posix_memalign(P, A, N) \
+          rt211_posix_memalign_at((P), (A), (N), __FILE__, __LINE__, __func__)
+#    ifdef LIB211_ALLOC_POSIX
+#      define rt211_strdup(S)     rt211_strdup_at((S), __FILE__, __LINE__, __func__)
+#      define rt211_strndup(S, N) rt211_strndup_at((S), (N), __FILE__, __LINE__, __func__)
+#      define rt211_getline(L, N, F) \
+            rt211_getline_at((L), (N), (F), __FILE__, __LINE__, __func__)
+#      define rt211_getdelim(L, N, D, F) \
+            rt211_getdelim_at((L), (N), (D), (F), __FILE__, __LINE__, __func__)
+#    endif
+#  endif
+
 #else
+// read_line(3) and friends must hand back C library blocks too.
 #  define read_line    read_line_raw_alloc
 #  define fread_line   fread_line_raw_alloc
 #  define xread_line   xread_line_raw_alloc
 #  define prompt_line  prompt_line_raw_alloc
+#  define RT211_ALLOC_INLINE
 #endif
 
 // See malloc(3), calloc(3), realloc(3), reallocf(3), and free(3).
-void* malloc(size_t size);
-void* calloc(size_t count, size_t size);
-void* realloc(void* ptr, size_t size);
-void* reallocf(void* ptr, size_t size);
-void  free(void* ptr);
+// (The parentheses keep the call-site macros from expanding here.)
+void* (rt211_malloc)(size_t size);
+void* (rt211_calloc)(size_t count, size_t size);
+void* (rt211_realloc)(void* ptr, size_t size);
+void* (rt211_reallocf)(void* ptr, size_t size);
+void  (rt211_free)(void* ptr);
+
+// Accounted versions of aligned_alloc(3) and posix_memalign(3).
+void* (rt211_aligned_alloc)(size_t alignment, size_t size);
+int   (rt211_posix_memalign)(void** memptr, size_t alignment, size_t size);
+
+// The same, but attributing the call to the given source location.
+void* rt211_malloc_at(size_t size,
+                      char const* file, int line, char const* func);
+void* rt211_calloc_at(size_t count, size_t size,
+                      char const* file, int line, char const* func);
+void* rt211_realloc_at(void* ptr, size_t size,
+                       char const* file, int line, char const* func);
+void* rt211_reallocf_at(void* ptr, size_t size,
+                        char const* file, int line, char const* func);
+void  rt211_free_at(void* ptr,
+                    char const* file, int line, char const* func);
+void* rt211_aligned_alloc_at(size_t alignment, size_t size,
+                             char const* file, int line, char const* func);
+int   rt211_posix_memalign_at(void** memptr, size_t alignment, size_t size,
+                              char const* file, int line, char const* func);
+
+#ifdef LIB211_ALLOC_POSIX
+// Accounted versions of strdup(3), strndup(3), getline(3) and
+// getdelim(3), and the same attributing the call to a source location.
+char*   (rt211_strdup)(char const* s);
+char*   (rt211_strndup)(char const* s, size_t n);
+ssize_t (rt211_getline)(char** lineptr, size_t* n, FILE* stream);
+ssize_t (rt211_getdelim)(char** lineptr, size_t* n, int delim, FILE* stream);
+
+char*   rt211_strdup_at(char const* s,
+                        char const* file, int line, char const* func);
+char*   rt211_strndup_at(char const* s, size_t n,
+                         char const* file, int line, char const* func);
+ssize_t rt211_getline_at(char** lineptr, size_t* n, FILE* stream,
+                         char const* file, int line, char const* func);
+ssize_t rt211_getdelim_at(char** lineptr, size_t* n, int delim, FILE* stream,
+                          char const* file, int line, char const* func);
+#endif
+
+#ifdef RT211_ALLOC_INLINE
+#  include <malloc.h>
+
+// The C library's versions, which <stdlib.h> and friends may not
+// declare under the user's feature-test macros.
+void* aligned_alloc(size_t alignment, size_t size);
+int   posix_memalign(void** memptr, size_t alignment, size_t size);
+
+#  ifdef LIB211_ALLOC_POSIX
+char*   strdup(char const* s);
+char*   strndup(char const* s, size_t n);
+ssize_t getdelim(char** lineptr, size_t* n, int delim, FILE* stream);
+ssize_t getline(char** lineptr, size_t* n, FILE* stream);
+#  endif
+
+// The C library has no reallocf(3). (Note that realloc(3) frees the
+// block itself if `size` is 0.)
+static inline void* rt211_libc_reallocf(void* ptr, size_t size)
+{
+    void* result = realloc(ptr, size);
+    if (!result && size) free(ptr);
+    return result;
+}
+
+#  if RT211_ALLOC_LEVEL(LIB211_ALLOC_MODE) == LIB211_ALLOC_MODE_stats
+#    include "211_alloc_stats.h"
+
+// Counts a new block `p`, if any, and returns it. Sizes are what
+// malloc_usable_size(3) says, since we have nowhere to keep the sizes
+// requested.
+static inline void* rt211_counted(void* p)
+{
+    if (p) rt211_count_alloc(malloc_usable_size(p));
+    return p;
+}
+
+static inline void* rt211_counted_malloc(size_t size)
+{
+    rt211_count_call(RT211_COUNT_MALLOC);
+    return rt211_counted(malloc(size));
+}
+
+static inline void* rt211_counted_calloc(size_t count, size_t size)
+{
+    rt211_count_call(RT211_COUNT_CALLOC);
+    return rt211_counted(calloc(count, size));
+}
+
+static inline void* rt211_counted_aligned_alloc(size_t alignment, size_t size)
+{
+    rt211_count_call(RT211_COUNT_MALLOC);
+    return rt211_counted(aligned_alloc(alignment, size));
+}
+
+static inline int
+rt211_counted_posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    rt211_count_call(RT211_COUNT_MALLOC);
+
+    int error = posix_memalign(memptr, alignment, size);
+    if (!error) rt211_counted(*memptr);
+    return error;
+}
+
+static inline void* rt211_counted_realloc(void* ptr, size_t size)
+{
+    rt211_count_call(RT211_COUNT_REALLOC);
+
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void*  result   = realloc(ptr, size);
+
+    if (result || !size) rt211_count_free(old_size);
+    return rt211_counted(result);
+}
+
+static inline void* rt211_counted_reallocf(void* ptr, size_t size)
+{
+    rt211_count_call(RT211_COUNT_REALLOC);
+
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void*  result   = rt211_libc_reallocf(ptr, size);
+
+    // Either way, the old block is gone.
+    rt211_count_free(old_size);
+    return rt211_counted(result);
+}
+
+static inline void rt211_counted_free(void* ptr)
+{
+    if (ptr) {
+        rt211_count_call(RT211_COUNT_FREE);
+        rt211_count_free(malloc_usable_size(ptr));
+    }
+
+    free(ptr);
+}
+
+#    ifdef LIB211_ALLOC_POSIX
+static inline char* rt211_counted_strdup(char const* s)
+{
+    rt211_count_call(RT211_COUNT_MALLOC);
+    return (char*) rt211_counted(strdup(s));
+}
+
+static inline char* rt211_counted_strndup(char const* s, size_t n)
+{
+    rt211_count_call(RT211_COUNT_MALLOC);
+    return (char*) rt211_counted(strndup(s, n));
+}
+
+// Counts any growth of the buffer as a single realloc(3).
+static inline ssize_t
+rt211_counted_getdelim(char** lineptr, size_t* n, int delim, FILE* stream)
+{
+    char*   old      = lineptr ? *lineptr : NULL;
+    size_t  old_size = old ? malloc_usable_size(old) : 0;
+    ssize_t result   = getdelim(lineptr, n, delim, stream);
+
+    if (lineptr && *lineptr &&
+            (*lineptr != old || malloc_usable_size(old) != old_size))
+    {
+        rt211_count_call(RT211_COUNT_REALLOC);
+        rt211_count_free(old_size);
+        rt211_counted(*lineptr);
+    }
+
+    return result;
+}
+
+static inline ssize_t
+rt211_counted_getline(char** lineptr, size_t* n, FILE* stream)
+{
+    return rt211_counted_getdelim(lineptr, n, '\n', stream);
+}
+
+#      undef  strdup
+#      undef  strndup
+#      undef  getline
+#      undef  getdelim
+#      define strdup        rt211_counted_strdup
+#      define strndup       rt211_counted_strndup
+#      define getline       rt211_counted_getline
+#      define getdelim      rt211_counted_getdelim
+#    endif // LIB211_ALLOC_POSIX
+
+#    undef  malloc
+#    undef  calloc
+#    undef  realloc
+#    undef  reallocf
+#    undef  free
+#    undef  aligned_alloc
+#    undef  posix_memalign
+#    define malloc          rt211_counted_malloc
+#    define calloc          rt211_counted_calloc
+#    define realloc         rt211_counted_realloc
+#    define reallocf        rt211_counted_reallocf
+#    define free            rt211_counted_free
+#    define aligned_alloc   rt211_counted_aligned_alloc
+#    define posix_memalign  rt211_counted_posix_memalign
+#  else
+#    undef  reallocf
+#    define reallocf        rt211_libc_reallocf
+#  endif
+#endif // RT211_ALLOC_INLINE
 
 #endif // _LIB211_ALLOC_H_
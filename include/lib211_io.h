@@ -29,7 +29,7 @@ __attribute__((format(printf, 1, 2)));
 
 // From <stdlib.h>, but necessary for using `read_line`, `fread_line`,
 // and `prompt_line` correctly.
-void free(void*);
+void (free)(void*);
 
 
 /*
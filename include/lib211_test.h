@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // CHECK(A) checks that `A` evaluates to true. (Returns value of `A` in
 // case you want it.)
@@ -47,6 +48,39 @@
 #define CHECK_STRING(A,B)   DISPATCH_CHECK(string, A,B)
 #define CHECK_POINTER(A,B)  DISPATCH_CHECK(pointer, A,B)
 
+// CHECK_MAX_ALLOCS(N, CODE)      runs CODE, checking that it makes at
+//                                most N calls to malloc, calloc or realloc.
+// CHECK_MAX_PEAK_BYTES(N, CODE)  runs CODE, checking that it never has
+//                                more than N more bytes allocated than
+//                                when it started.
+// ASSERT_NO_ALLOC { ... }        runs the block, checking that it
+//                                doesn't allocate at all.
+//
+// CODE may be an expression or a braced block. Only allocation counted
+// by alloc_stats_get(3) is seen, in the sizes it counts (the sizes
+// requested; see CHECK(3)), and jumping out of CODE (with `break`,
+// `return` or `goto`) skips the check.
+//
+// Examples:
+//
+//   CHECK_MAX_ALLOCS( 0, total = sum(v) );
+//   CHECK_MAX_PEAK_BYTES( 1024, { vec_push(v, 1); vec_push(v, 2); } );
+//
+//   ASSERT_NO_ALLOC {
+//       for (size_t i = 0; i < n; ++i) hash_lookup(h, keys[i]);
+//   }
+//
+#define CHECK_MAX_ALLOCS(N, ...) \
+    LIB211_BUDGET((N), SIZE_MAX, #__VA_ARGS__, __VA_ARGS__)
+#define CHECK_MAX_PEAK_BYTES(N, ...) \
+    LIB211_BUDGET(SIZE_MAX, (N), #__VA_ARGS__, __VA_ARGS__)
+#define ASSERT_NO_ALLOC \
+    for (struct lib211_alloc_budget lib211_budget_ = \
+            lib211_budget_begin(0, SIZE_MAX, "ASSERT_NO_ALLOC", \
+                                __FILE__, __LINE__); \
+         !lib211_budget_.done; \
+         lib211_budget_end(&lib211_budget_))
+
 // RUN_TEST takes a function with no arguments and no results, and
 // calls it as a test. (This means it prints progress and success or
 // failure information.)
@@ -71,6 +105,43 @@ void start_testing(void);
     lib211_do_check_##T((A),(B),#A,#B,__FILE__,__LINE__)
 
 
+// Helper for `CHECK_MAX_ALLOCS` and `CHECK_MAX_PEAK_BYTES` above. They
+// stringify the code themselves, since by the time it gets here any
+// macros in it (such as `malloc`) have been expanded.
+#define LIB211_BUDGET(MAX_ALLOCS, MAX_PEAK, CODE_STR, ...) \
+    do { \
+        struct lib211_alloc_budget lib211_budget_ = \
+            lib211_budget_begin((MAX_ALLOCS), (MAX_PEAK), (CODE_STR), \
+                                __FILE__, __LINE__); \
+        __VA_ARGS__; \
+        lib211_budget_end(&lib211_budget_); \
+    } while (0)
+
+// Helper struct for the allocation budget macros above.
+struct lib211_alloc_budget
+{
+    size_t max_allocs;      // most allocation calls allowed
+    size_t max_peak;        // most bytes allowed above `start_bytes`
+    size_t start_allocs;    // allocation calls before the code ran
+    size_t start_bytes;     // bytes allocated before the code ran
+    size_t saved_peak;      // the peak before the code ran
+    char const* code;
+    char const* file;
+    int line;
+    bool done;
+};
+
+// Helper functions used by the allocation budget macros above. The
+// first starts measuring, and the second stops and does the check.
+struct lib211_alloc_budget lib211_budget_begin(
+        size_t max_allocs,
+        size_t max_peak,
+        char const* code,       // source code being measured
+        char const* file,
+        int line);
+
+bool lib211_budget_end(struct lib211_alloc_budget*);
+
 // Helper function used by `CHECK` macro above.
 bool lib211_do_check(
         bool condition,         // did the check pass?
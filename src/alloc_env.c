@@ -0,0 +1,153 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Expands `%p` and `%%` in file name `pattern` into `buf`. Returns false
+// if the result doesn't fit.
+static bool
+expand_path(char const* pattern, char* buf, size_t size)
+{
+    size_t len = 0;
+
+    for (char const* p = pattern; *p; ++p) {
+        int n;
+
+        if (p[0] == '%' && p[1] == 'p') {
+            n = snprintf(buf + len, size - len, "%ld", (long) getpid());
+            ++p;
+        } else if (p[0] == '%' && p[1] == '%') {
+            n = snprintf(buf + len, size - len, "%%");
+            ++p;
+        } else {
+            n = snprintf(buf + len, size - len, "%c", *p);
+        }
+
+        if (n < 0 || (size_t) n >= size - len) return false;
+        len += (size_t) n;
+    }
+
+    return true;
+}
+
+FILE* rt211_env_output(char const* name)
+{
+    const char* dst = getenv(name);
+
+    if (! dst || ! *dst) {
+        return NULL;
+    } else if (dst[0] == '&' && dst[1] != 0) {
+        char* endptr;
+        long fd = strtol(&dst[1], &endptr, 10);
+        if (*endptr == 0 && 0 <= fd && fd <= (long)INT_MAX) {
+            return fdopen((int)fd, "w");
+        }
+        return NULL;
+    } else {
+        char path[PATH_MAX];
+        return expand_path(dst, path, sizeof path) ? fopen(path, "w") : NULL;
+    }
+}
+
+FILE* rt211_env_child_output(char const* name)
+{
+    const char* dst = getenv(name);
+    errno = 0;
+
+    if (! dst || ! *dst || (dst[0] == '&' && dst[1] != 0)) return NULL;
+
+    char path[PATH_MAX];
+    if (!expand_path(dst, path, sizeof path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (!rt211_env_per_process(name)) {
+        size_t len = strlen(path);
+        int    n   = snprintf(path + len, sizeof path - len, ".%ld",
+                              (long) getpid());
+        if (n < 0 || (size_t) n >= sizeof path - len) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+    }
+
+    return fopen(path, "w");
+}
+
+bool rt211_env_per_process(char const* name)
+{
+    const char* dst = getenv(name);
+
+    for (char const* p = dst; p && *p && *dst != '&'; ++p) {
+        if (p[0] == '%' && p[1] == 'p') return true;
+        if (p[0] == '%' && p[1] == '%') ++p;
+    }
+
+    return false;
+}
+
+void rt211_env_close(FILE* out)
+{
+    if (! out) return;
+
+    if (fileno(out) <= STDERR_FILENO) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+void rt211_env_invalid(char const* name, char const* value)
+{
+    fprintf(stderr, "rt211_alloc: could not understand %s value: ‘%s’",
+            name, value);
+    exit(254);
+}
+
+bool rt211_env_size(char const* name, size_t* out)
+{
+    char *const original = getenv(name),
+         *begin = original,
+         *end;
+    unsigned long size;
+
+    if (!begin) return false;
+
+    while (isspace(*begin)) ++begin;
+    if (!*begin) return false;
+
+    size = strtoul(begin, &end, 10);
+    if (begin == end)
+        rt211_env_invalid(name, original);
+
+    while (isspace(*end)) ++end;
+
+    switch (*end) {
+    case 'B': case 'b': case 0:
+        *out = size;
+        return true;
+
+    case 'K': case 'k':
+        *out = size << 10;
+        return true;
+
+    case 'M': case 'm':
+        *out = size << 20;
+        return true;
+
+    case 'G': case 'g':
+        *out = size << 30;
+        return true;
+
+    default:
+        rt211_env_invalid(name, original);
+    }
+}
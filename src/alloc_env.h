@@ -0,0 +1,39 @@
+#pragma once
+
+// Helpers for the RT211_* environment variables.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdnoreturn.h>
+
+// Opens the destination named by environment variable `name` for
+// writing, or returns NULL if it's unset or can't be opened. The value
+// is either a file name or `&` followed by a file descriptor number,
+// as in `RT211_TRACE=&2`. In a file name, `%p` stands for the process
+// ID and `%%` for `%`.
+FILE* rt211_env_output(char const* name);
+
+// Opens a file of its own for a process forked from the one that opened
+// `name`'s destination: the same file name, with `%p` now standing for
+// the child, or with `.` and the child's process ID appended if there's
+// no `%p`. Returns NULL, with `errno` set, if the file can't be opened,
+// or with `errno` 0 if the destination is a file descriptor.
+FILE* rt211_env_child_output(char const* name);
+
+// Does environment variable `name` name a different file for each
+// process (using `%p`)?
+bool rt211_env_per_process(char const* name);
+
+// Closes a stream from `rt211_env_output`, except that the standard
+// streams are only flushed, since others may still want them.
+void rt211_env_close(FILE*);
+
+// Reads a byte count from environment variable `name`: a number,
+// optionally followed by `K`, `M` or `G`. Returns false if the variable
+// is unset or blank, and exits with an error if it's malformed.
+bool rt211_env_size(char const* name, size_t* out);
+
+// Complains that environment variable `name` has a bad `value`, and
+// exits.
+noreturn void rt211_env_invalid(char const* name, char const* value);
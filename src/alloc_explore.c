@@ -0,0 +1,235 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_explore.h"
+#include "alloc_sites.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// One child, which failed the `index`th allocation.
+struct explorer
+{
+    pid_t              pid;
+    size_t             index;
+    struct alloc_site* site;
+    int                status;
+};
+
+static pthread_once_t  explore_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t explore_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE*  explore_out = NULL;
+static bool   exploring   = false;
+static size_t max_jobs;
+static size_t alloc_count = 0;
+
+// Children in the order they were forked; the first `reaped` of them
+// have finished.
+static struct explorer* children = NULL;
+static size_t           child_count = 0;
+static size_t           child_cap   = 0;
+static size_t           reaped      = 0;
+
+static void write_summary(void);
+
+// Whether this thread is forking a child in `rt211_explore_fork`, which
+// holds `explore_lock` already.
+static _Thread_local bool forking = false;
+
+static void
+before_fork(void)
+{
+    if (!forking) pthread_mutex_lock(&explore_lock);
+}
+
+static void
+after_fork_in_parent(void)
+{
+    if (!forking) pthread_mutex_unlock(&explore_lock);
+}
+
+// Whether it's one of ours or another fork(2) by the program, the new
+// process can't wait for our children, so only the original process
+// explores and writes the summary.
+static void
+after_fork_in_child(void)
+{
+    free(children);
+    children    = NULL;
+    child_count = child_cap = reaped = 0;
+    exploring   = false;
+    explore_out = NULL;
+
+    if (!forking) pthread_mutex_unlock(&explore_lock);
+}
+
+static void
+explore_init(void)
+{
+    explore_out = rt211_env_output("RT211_ALLOC_EXPLORE");
+    if (!explore_out) return;
+
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char const* jobs_str = getenv("RT211_ALLOC_EXPLORE_JOBS");
+    if (jobs_str && *jobs_str) jobs = strtol(jobs_str, NULL, 10);
+    max_jobs = jobs > 0 ? (size_t) jobs : 1;
+
+    exploring = true;
+    pthread_atfork(&before_fork, &after_fork_in_parent, &after_fork_in_child);
+    atexit(&write_summary);
+}
+
+bool rt211_explore_enabled(void)
+{
+    pthread_once(&explore_once, &explore_init);
+    return exploring;
+}
+
+static void
+reap_oldest(void)
+{
+    struct explorer* child = &children[reaped++];
+
+    while (waitpid(child->pid, &child->status, 0) < 0) {
+        if (errno != EINTR) {
+            child->status = -1;
+            break;
+        }
+    }
+}
+
+// Sends the child's output to /dev/null. (The fork handler has already
+// stopped it from exploring or reporting.)
+static void
+become_failure_child(void)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO) close(fd);
+    }
+}
+
+bool rt211_explore_fork(struct alloc_site* site)
+{
+    if (!rt211_explore_enabled()) return false;
+
+    pthread_mutex_lock(&explore_lock);
+
+    if (!exploring) {
+        pthread_mutex_unlock(&explore_lock);
+        return false;
+    }
+
+    if (child_count == child_cap) {
+        size_t cap = child_cap ? 2 * child_cap : 64;
+        struct explorer* bigger = realloc(children, cap * sizeof *bigger);
+        if (!bigger) {
+            pthread_mutex_unlock(&explore_lock);
+            return false;
+        }
+        children  = bigger;
+        child_cap = cap;
+    }
+
+    while (child_count - reaped >= max_jobs)
+        reap_oldest();
+
+    size_t index = ++alloc_count;
+
+    // Don't let the child inherit our unflushed output, or it might get
+    // written twice.
+    fflush(NULL);
+
+    forking = true;
+    pid_t pid = fork();
+    forking = false;
+
+    if (pid == 0) {
+        become_failure_child();
+        pthread_mutex_unlock(&explore_lock);
+        return true;
+    }
+
+    if (pid > 0) {
+        children[child_count++] = (struct explorer) {
+            .pid   = pid,
+            .index = index,
+            .site  = site,
+        };
+    }
+
+    pthread_mutex_unlock(&explore_lock);
+    return false;
+}
+
+static void
+describe_status(int status, char* buf, size_t size)
+{
+    if (status < 0)
+        snprintf(buf, size, "lost");
+    else if (WIFEXITED(status))
+        snprintf(buf, size, "exit %d", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        snprintf(buf, size, "signal %d (%s)", WTERMSIG(status),
+                 strsignal(WTERMSIG(status)));
+    else
+        snprintf(buf, size, "status %#x", status);
+}
+
+static void
+write_summary(void)
+{
+    if (!explore_out) return;
+
+    pthread_mutex_lock(&explore_lock);
+    exploring = false;
+
+    while (reaped < child_count)
+        reap_oldest();
+
+    size_t clean = 0, failed = 0, crashed = 0;
+
+    for (size_t i = 0; i < child_count; ++i) {
+        int status = children[i].status;
+        if (status < 0 || !WIFEXITED(status))
+            ++crashed;
+        else if (WEXITSTATUS(status))
+            ++failed;
+        else
+            ++clean;
+    }
+
+    fprintf(explore_out,
+            "lib211_alloc: explored %zu allocation failures in process %ld: "
+            "%zu exited 0, %zu exited nonzero, %zu crashed\n",
+            child_count, (long) getpid(), clean, failed, crashed);
+
+    if (child_count)
+        fprintf(explore_out, "%10s  %-32s  %s\n", "alloc", "result", "site");
+
+    for (size_t i = 0; i < child_count; ++i) {
+        char result[64], name[256] = "(unknown)";
+
+        describe_status(children[i].status, result, sizeof result);
+        if (children[i].site)
+            rt211_site_name(children[i].site, name, sizeof name);
+
+        fprintf(explore_out, "%10zu  %-32s  %s\n",
+                children[i].index, result, name);
+    }
+
+    rt211_env_close(explore_out);
+    explore_out = NULL;
+    pthread_mutex_unlock(&explore_lock);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Exhaustive out-of-memory exploration. With RT211_ALLOC_EXPLORE set
+// (to a file name or `&fd`), every allocation forks the process: the
+// child sees the allocation fail and runs to completion with its output
+// discarded, while the parent sees it succeed and carries on, forking
+// again at the next allocation. At exit the parent waits for all its
+// children and writes a summary of how each one ended. Processes forked
+// by the program itself don't explore.
+//
+// RT211_ALLOC_EXPLORE_JOBS limits how many children run at once
+// (default: the number of CPUs).
+
+#include <stdbool.h>
+
+struct alloc_site;
+
+// Is this process exploring?
+bool rt211_explore_enabled(void);
+
+// Called before each allocation made from `site`. Forks if exploring,
+// returning true in the child, where the allocation should fail.
+bool rt211_explore_fork(struct alloc_site* site);
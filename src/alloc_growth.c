@@ -0,0 +1,274 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_growth.h"
+#include "alloc_sites.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// How many reallocs in a row must grow a block by the same step before
+// we call it linear growth. (Geometric growth never repeats a step.)
+#define LINEAR_RUN      8
+
+// A block copied more than this many times its current size while
+// moving is copied too much, unless it's copied less than COPY_FLOOR
+// bytes in all. (Doubling copies less than its size.)
+#define COPY_FACTOR     4
+#define COPY_FLOOR      4096
+
+// How many grow-after-shrink reallocs make a site worth listing.
+#define REGROW_REPORT   4
+
+// Blocks we've seen reallocated, in a chained hash table keyed on their
+// current addresses. Every LOCK_STRIPE-th bucket shares a lock.
+#define BUCKETS         ((size_t) 1 << 14)
+#define LOCK_STRIPES    64
+
+// The history of one block.
+struct growth
+{
+    struct growth* next;
+    void*  pointer;
+    size_t size;        // as last requested
+    size_t step;        // how much the last realloc grew it, or 0
+    size_t run;         // how many reallocs in a row grew it by `step`
+    size_t copied;      // bytes copied moving it so far
+    bool   shrunk;      // whether the last realloc shrank it
+    bool   linear;      // whether we've counted it as linear
+    bool   overcopied;  // whether we've counted it as overcopied
+};
+
+static struct growth*  buckets[BUCKETS];
+static pthread_mutex_t stripes[LOCK_STRIPES];
+
+static pthread_once_t growth_once = PTHREAD_ONCE_INIT;
+static FILE* growth_out = NULL;
+static pid_t owner;                 // only this process writes at exit
+
+static void report_growth(void);
+
+static void
+lock_all_stripes(void)
+{
+    for (size_t i = 0; i < LOCK_STRIPES; ++i)
+        pthread_mutex_lock(&stripes[i]);
+}
+
+static void
+unlock_all_stripes(void)
+{
+    for (size_t i = LOCK_STRIPES; i-- > 0; )
+        pthread_mutex_unlock(&stripes[i]);
+}
+
+static void
+growth_init(void)
+{
+    growth_out = rt211_env_output("RT211_ALLOC_GROWTH");
+    if (!growth_out) return;
+
+    for (size_t i = 0; i < LOCK_STRIPES; ++i)
+        pthread_mutex_init(&stripes[i], NULL);
+
+    if (pthread_atfork(&lock_all_stripes, &unlock_all_stripes,
+                       &unlock_all_stripes))
+    {
+        perror("lib211_alloc");
+        exit(255);
+    }
+
+    owner = getpid();
+    atexit(&report_growth);
+}
+
+bool rt211_growth_enabled(void)
+{
+    pthread_once(&growth_once, &growth_init);
+    return growth_out != NULL;
+}
+
+static size_t
+bucket_of(void const* p)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p * UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t) (h >> 32) & (BUCKETS - 1);
+}
+
+// Removes and returns the history of `p`, or NULL if it has none.
+static struct growth*
+take_history(void const* p)
+{
+    size_t i = bucket_of(p);
+    struct growth* found = NULL;
+
+    pthread_mutex_lock(&stripes[i % LOCK_STRIPES]);
+
+    for (struct growth** link = &buckets[i]; *link; link = &(*link)->next) {
+        if ((*link)->pointer == p) {
+            found = *link;
+            *link = found->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&stripes[i % LOCK_STRIPES]);
+    return found;
+}
+
+static void
+put_history(struct growth* g)
+{
+    size_t i = bucket_of(g->pointer);
+
+    pthread_mutex_lock(&stripes[i % LOCK_STRIPES]);
+    g->next    = buckets[i];
+    buckets[i] = g;
+    pthread_mutex_unlock(&stripes[i % LOCK_STRIPES]);
+}
+
+void rt211_growth_realloc(struct alloc_site* site,
+                          void* old_ptr, size_t old_size,
+                          void* new_ptr, size_t size)
+{
+    if (!site) return;
+
+    struct growth* g = take_history(old_ptr);
+
+    if (!g) {
+        g = calloc(1, sizeof *g);
+        if (!g) return;
+        g->size = old_size;
+    }
+
+    atomic_fetch_add_explicit(&site->reallocs, 1, memory_order_relaxed);
+
+    if (new_ptr != old_ptr) {
+        size_t copy = g->size < size ? g->size : size;
+        g->copied += copy;
+        atomic_fetch_add_explicit(&site->moves, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->bytes_copied, copy,
+                                  memory_order_relaxed);
+    }
+
+    if (size > g->size) {
+        size_t step = size - g->size;
+
+        if (g->shrunk)
+            atomic_fetch_add_explicit(&site->regrows, 1,
+                                      memory_order_relaxed);
+
+        g->run  = step == g->step ? g->run + 1 : 1;
+        g->step = step;
+
+        if (g->run >= LINEAR_RUN && !g->linear) {
+            g->linear = true;
+            atomic_fetch_add_explicit(&site->linear_blocks, 1,
+                                      memory_order_relaxed);
+        }
+    } else {
+        g->run  = 0;
+        g->step = 0;
+    }
+
+    g->shrunk  = size < g->size;
+    g->size    = size;
+    g->pointer = new_ptr;
+
+    if (g->copied >= COPY_FLOOR && g->copied > COPY_FACTOR * size &&
+            !g->overcopied)
+    {
+        g->overcopied = true;
+        atomic_fetch_add_explicit(&site->overcopied_blocks, 1,
+                                  memory_order_relaxed);
+    }
+
+    put_history(g);
+}
+
+void rt211_growth_free(void* ptr)
+{
+    free(take_history(ptr));
+}
+
+static bool
+is_problem(struct alloc_site const* site)
+{
+    return site->linear_blocks || site->overcopied_blocks ||
+           site->regrows >= REGROW_REPORT;
+}
+
+struct problem_list
+{
+    struct alloc_site** sites;
+    size_t count;
+    size_t capacity;
+};
+
+static void
+collect_problem(struct alloc_site* site, void* aux)
+{
+    struct problem_list* list = aux;
+
+    if (!is_problem(site)) return;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 16;
+        struct alloc_site** sites = realloc(list->sites,
+                                            capacity * sizeof *sites);
+        if (!sites) return;
+        list->sites    = sites;
+        list->capacity = capacity;
+    }
+
+    list->sites[list->count++] = site;
+}
+
+static int
+compare_by_copied(void const* a, void const* b)
+{
+    size_t x = (*(struct alloc_site* const*) a)->bytes_copied,
+           y = (*(struct alloc_site* const*) b)->bytes_copied;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void
+report_growth(void)
+{
+    if (getpid() != owner) return;
+
+    struct problem_list list = { NULL, 0, 0 };
+    rt211_sites_for_each(&collect_problem, &list);
+
+    qsort(list.sites, list.count, sizeof *list.sites, &compare_by_copied);
+
+    fprintf(growth_out, "lib211_alloc: %zu realloc sites with growth "
+                        "problems\n", list.count);
+
+    if (list.count) {
+        fprintf(growth_out, "%10s %10s %14s %8s %8s %10s  %s\n",
+                "reallocs", "moves", "bytes copied",
+                "linear", "regrows", "overcopied", "site");
+    }
+
+    for (size_t i = 0; i < list.count; ++i) {
+        struct alloc_site* site = list.sites[i];
+        char name[256];
+
+        fprintf(growth_out, "%10zu %10zu %14zu %8zu %8zu %10zu  %s\n",
+                (size_t) site->reallocs,
+                (size_t) site->moves,
+                (size_t) site->bytes_copied,
+                (size_t) site->linear_blocks,
+                (size_t) site->regrows,
+                (size_t) site->overcopied_blocks,
+                rt211_site_name(site, name, sizeof name));
+    }
+
+    free(list.sites);
+    rt211_env_close(growth_out);
+    growth_out = NULL;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Realloc growth analysis. Setting RT211_ALLOC_GROWTH (to a file name
+// or `&fd`) follows each block through its reallocs, and at exit lists
+// the realloc call sites whose blocks grow badly: by the same small
+// step over and over instead of geometrically, by growing again right
+// after shrinking, or by being copied many times their size as they
+// move. Each site also gets its count of moves and bytes copied.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct alloc_site;
+
+// Is growth analysis turned on?
+bool rt211_growth_enabled(void);
+
+// Notes that a realloc at `site` resized block `old_ptr` from
+// `old_size` to `size` bytes, and that it's now at `new_ptr`.
+void rt211_growth_realloc(struct alloc_site* site,
+                          void* old_ptr, size_t old_size,
+                          void* new_ptr, size_t size);
+
+// Notes that block `ptr` was freed, ending its history.
+void rt211_growth_free(void* ptr);
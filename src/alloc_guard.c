@@ -0,0 +1,323 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_guard.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of canary after the user's block, and at least this many
+// before it.
+#define REDZONE         16
+
+#define CANARY_BYTE     0xFB
+#define POISON_BYTE     0xDF
+
+#define DEFAULT_QUARANTINE  ((size_t) 1 << 20)
+
+// The most blocks the quarantine holds, whatever their size.
+#define QUARANTINE_SLOTS    4096
+
+// Sits just before the user's block, with the front redzone before it.
+// Keeping the magic number, and what it's computed from, within 16 bytes
+// of the user's pointer means `rt211_guard_owns` never reads past the C
+// library's own chunk header when given a block that isn't ours. The
+// magic covers `size` and `offset`, so an underflow that lands on them
+// makes the block look foreign, and the C library rejects it when it's
+// freed.
+struct guard_header
+{
+    size_t   prefix;        // see `rt211_guard_set_prefix`
+    size_t   size;
+    uint32_t offset;        // of the user's block in the underlying one
+    uint32_t magic;         // `magic_for(p)`, or that ^ FREED
+};
+
+#define FREED           UINT32_C(0xDEADF7EE)
+
+_Static_assert(sizeof(struct guard_header) -
+               offsetof(struct guard_header, size) <= 16,
+               "magic must be within 16 bytes of the user's pointer");
+
+// The front redzone fills whatever keeps the user's block aligned.
+#define ALIGN           _Alignof(max_align_t)
+#define FRONT           ((REDZONE + sizeof(struct guard_header) + ALIGN - 1) \
+                         & ~(ALIGN - 1))
+#define FRONT_REDZONE   (FRONT - sizeof(struct guard_header))
+
+#define HEADER_OF(P)    ((struct guard_header*) (P) - 1)
+#define FRONT_ZONE(P)   ((unsigned char*) (P) - FRONT)
+#define BACK_ZONE(P)    ((unsigned char*) (P) + HEADER_OF(P)->size)
+#define BASE_OF(P)      ((char*) (P) - HEADER_OF(P)->offset)
+
+// The part of block `P` that's the user's, past the caller's prefix.
+#define USER_OF(P)      ((unsigned char*) (P) + HEADER_OF(P)->prefix)
+#define USER_SIZE(P)    (HEADER_OF(P)->size - HEADER_OF(P)->prefix)
+
+static pthread_once_t  guard_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool   guard_on = false;
+static size_t quarantine_limit;
+
+// A ring of freed blocks, oldest first.
+static void*  quarantine[QUARANTINE_SLOTS];
+static size_t quarantine_head  = 0;
+static size_t quarantine_count = 0;
+static size_t quarantine_bytes = 0;
+
+static void drain_quarantine(void);
+
+static void
+before_fork(void)
+{
+    pthread_mutex_lock(&quarantine_lock);
+}
+
+static void
+after_fork(void)
+{
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+static void
+guard_init(void)
+{
+    char const* value = getenv("RT211_ALLOC_GUARD");
+    guard_on = value && *value && strcmp(value, "0") != 0;
+
+    if (!guard_on) return;
+
+    if (!rt211_env_size("RT211_ALLOC_QUARANTINE", &quarantine_limit))
+        quarantine_limit = DEFAULT_QUARANTINE;
+
+    pthread_atfork(&before_fork, &after_fork, &after_fork);
+    atexit(&drain_quarantine);
+}
+
+bool rt211_guard_enabled(void)
+{
+    pthread_once(&guard_once, &guard_init);
+    return guard_on;
+}
+
+// This and `rt211_guard_owns` read the header of blocks that may not be
+// ours, which is harmless but would upset ASan.
+__attribute__((no_sanitize_address))
+static uint32_t
+magic_for(void const* p)
+{
+    struct guard_header const* header = HEADER_OF(p);
+    uint64_t h = ((uint64_t) (uintptr_t) p ^ header->size) *
+                 UINT64_C(0x9e3779b97f4a7c15);
+    return (uint32_t) (h >> 32) ^ header->offset;
+}
+
+__attribute__((no_sanitize_address))
+bool rt211_guard_owns(void const* p)
+{
+    uint32_t magic = HEADER_OF(p)->magic;
+    uint32_t want  = magic_for(p);
+    return magic == want || magic == (want ^ FREED);
+}
+
+size_t rt211_guard_size(void const* p)
+{
+    return HEADER_OF(p)->size;
+}
+
+void rt211_guard_set_prefix(void* p, size_t prefix)
+{
+    HEADER_OF(p)->prefix = prefix;
+}
+
+static _Noreturn void
+guard_error(char const* what, void const* p)
+{
+    fprintf(stderr, "lib211_alloc: %s in block %p of %zu bytes\n",
+            what, (void*) USER_OF(p), USER_SIZE(p));
+    abort();
+}
+
+static bool
+all_bytes(unsigned char const* bytes, size_t n, unsigned char value)
+{
+    for (size_t i = 0; i < n; ++i)
+        if (bytes[i] != value) return false;
+
+    return true;
+}
+
+// Aborts unless `p`'s redzones are intact.
+static void
+check_block(void const* p)
+{
+    if (HEADER_OF(p)->magic != magic_for(p))
+        guard_error("double free", p);
+
+    if (!all_bytes(FRONT_ZONE(p), FRONT_REDZONE, CANARY_BYTE))
+        guard_error("buffer underflow", p);
+
+    if (!all_bytes(BACK_ZONE(p), REDZONE, CANARY_BYTE))
+        guard_error("buffer overflow", p);
+}
+
+// Sets up a guarded block of `size` bytes `offset` bytes into `base`.
+static void*
+place_block(void* base, size_t offset, size_t size)
+{
+    if (!base) return NULL;
+
+    void* p = (char*) base + offset;
+
+    HEADER_OF(p)->prefix = 0;
+    HEADER_OF(p)->size   = size;
+    HEADER_OF(p)->offset = (uint32_t) offset;
+    HEADER_OF(p)->magic  = magic_for(p);
+
+    memset(FRONT_ZONE(p), CANARY_BYTE, FRONT_REDZONE);
+    memset(BACK_ZONE(p), CANARY_BYTE, REDZONE);
+    return p;
+}
+
+void* rt211_guard_malloc(size_t size)
+{
+    if (size > SIZE_MAX - FRONT - REDZONE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return place_block(malloc(FRONT + size + REDZONE), FRONT, size);
+}
+
+void* rt211_guard_calloc(size_t nmemb, size_t size)
+{
+    if (nmemb && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* p = rt211_guard_malloc(nmemb * size);
+    if (p) memset(p, 0, nmemb * size);
+    return p;
+}
+
+int rt211_guard_memalign(void** out, size_t alignment, size_t size)
+{
+    if (alignment <= _Alignof(max_align_t)) {
+        *out = rt211_guard_malloc(size);
+        return *out ? 0 : ENOMEM;
+    }
+
+    size_t offset = (FRONT + alignment - 1) & ~(alignment - 1);
+
+    if (offset > UINT32_MAX || size > SIZE_MAX - offset - REDZONE)
+        return ENOMEM;
+
+    void* base;
+    int   error = posix_memalign(&base, alignment, offset + size + REDZONE);
+    if (error) return error;
+
+    *out = place_block(base, offset, size);
+    return 0;
+}
+
+void* rt211_guard_realloc(void* p, size_t size)
+{
+    check_block(p);
+
+    void* q = rt211_guard_malloc(size);
+    if (!q) return NULL;
+
+    size_t old_size = HEADER_OF(p)->size;
+    memcpy(q, p, old_size < size ? old_size : size);
+    HEADER_OF(q)->prefix = HEADER_OF(p)->prefix;
+    rt211_guard_free(p);
+    return q;
+}
+
+// Aborts unless freed block `p` is still all poison, then releases it.
+static void
+release(void* p)
+{
+    if (!all_bytes(USER_OF(p), USER_SIZE(p), POISON_BYTE))
+        guard_error("write after free", p);
+
+    if (!all_bytes(FRONT_ZONE(p), FRONT_REDZONE, CANARY_BYTE) ||
+            !all_bytes(BACK_ZONE(p), REDZONE, CANARY_BYTE))
+        guard_error("write after free (to a redzone)", p);
+
+    HEADER_OF(p)->magic = 0;
+    free(BASE_OF(p));
+}
+
+// Takes the oldest block out of quarantine. Call with the lock held.
+static void*
+quarantine_pop(void)
+{
+    void* p = quarantine[quarantine_head];
+    quarantine_head = (quarantine_head + 1) % QUARANTINE_SLOTS;
+    --quarantine_count;
+    quarantine_bytes -= USER_SIZE(p);
+    return p;
+}
+
+void rt211_guard_free(void* p)
+{
+    check_block(p);
+
+    size_t size = USER_SIZE(p);
+    memset(USER_OF(p), POISON_BYTE, size);
+    HEADER_OF(p)->magic ^= FREED;
+
+    if (size > quarantine_limit) {
+        release(p);
+        return;
+    }
+
+    // Make room, then release what we evicted outside the lock.
+    void*  evicted[8];
+    size_t nevicted = 0;
+
+    pthread_mutex_lock(&quarantine_lock);
+
+    while (quarantine_count &&
+           (quarantine_count == QUARANTINE_SLOTS ||
+            quarantine_bytes + size > quarantine_limit) &&
+           nevicted < sizeof evicted / sizeof *evicted)
+    {
+        evicted[nevicted++] = quarantine_pop();
+    }
+
+    bool fits = quarantine_count < QUARANTINE_SLOTS &&
+                quarantine_bytes + size <= quarantine_limit;
+
+    if (fits) {
+        quarantine[(quarantine_head + quarantine_count) % QUARANTINE_SLOTS] = p;
+        ++quarantine_count;
+        quarantine_bytes += size;
+    }
+
+    pthread_mutex_unlock(&quarantine_lock);
+
+    for (size_t i = 0; i < nevicted; ++i)
+        release(evicted[i]);
+
+    if (!fits) release(p);
+}
+
+// Checks everything still in quarantine.
+static void
+drain_quarantine(void)
+{
+    pthread_mutex_lock(&quarantine_lock);
+
+    while (quarantine_count)
+        release(quarantine_pop());
+
+    pthread_mutex_unlock(&quarantine_lock);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// A cheap memory-error check for the unsanitized library. Setting
+// RT211_ALLOC_GUARD (to anything but 0) puts a canary-filled redzone on
+// each side of every new block, checked when the block is freed or
+// reallocated, and fills freed blocks with a poison pattern before
+// holding them in a FIFO quarantine of RT211_ALLOC_QUARANTINE bytes
+// (default 1M). A block whose poison was disturbed by the time it
+// leaves quarantine (or at exit) was written after being freed. Either
+// kind of error is reported on stderr and aborts.
+//
+// This sits below the rest of lib211: the functions here stand in for
+// the C library's, and blocks allocated before guarding started are
+// passed through to it.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Is guarding turned on?
+bool rt211_guard_enabled(void);
+
+// Allocate guarded blocks, as malloc(3), calloc(3) and
+// posix_memalign(3) do.
+void* rt211_guard_malloc(size_t size);
+void* rt211_guard_calloc(size_t nmemb, size_t size);
+int   rt211_guard_memalign(void** out, size_t alignment, size_t size);
+
+// Is `p` a guarded block? (`p` must be a block from some allocator.)
+bool rt211_guard_owns(void const* p);
+
+// These take guarded blocks only.
+void*  rt211_guard_realloc(void* p, size_t size);
+void   rt211_guard_free(void* p);
+size_t rt211_guard_size(void const* p);
+
+// Says that the first `prefix` bytes of guarded block `p` are the
+// caller's own header rather than the user's: errors describe the rest
+// of the block, and freeing leaves the header unpoisoned (so the caller
+// can still recognize it) and unchecked.
+void   rt211_guard_set_prefix(void* p, size_t prefix);
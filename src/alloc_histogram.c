@@ -0,0 +1,159 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_histogram.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Class 0 holds requests for 0 bytes, and class k > 0 holds requests
+// from 2^(k-1) to 2^k - 1 bytes; that is, k is the bit width.
+#define CLASSES  (sizeof(size_t) * CHAR_BIT + 1)
+
+static struct size_class
+{
+    _Atomic size_t count;
+    _Atomic size_t bytes;
+    _Atomic size_t slack;
+}       classes[CLASSES];
+
+static _Atomic size_t max_request;
+
+static pthread_once_t histogram_once = PTHREAD_ONCE_INIT;
+static FILE* histogram_out = NULL;
+static pid_t owner;                 // only this process writes at exit
+
+static void dump_histogram(void);
+
+static void
+histogram_init(void)
+{
+    histogram_out = rt211_env_output("RT211_ALLOC_HISTOGRAM");
+    if (histogram_out) {
+        owner = getpid();
+        atexit(&dump_histogram);
+    }
+}
+
+bool rt211_histogram_enabled(void)
+{
+    pthread_once(&histogram_once, &histogram_init);
+    return histogram_out != NULL;
+}
+
+static size_t
+class_of(size_t size)
+{
+    size_t k = 0;
+    while (size) {
+        size >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+static size_t
+class_min(size_t k)
+{
+    return k ? (size_t) 1 << (k - 1) : 0;
+}
+
+static size_t
+class_max(size_t k)
+{
+    return k ? class_min(k) + (class_min(k) - 1) : 0;
+}
+
+void rt211_histogram_add(size_t size, size_t usable)
+{
+    struct size_class* c = &classes[class_of(size)];
+
+    atomic_fetch_add_explicit(&c->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->bytes, size, memory_order_relaxed);
+    if (usable > size)
+        atomic_fetch_add_explicit(&c->slack, usable - size,
+                                  memory_order_relaxed);
+
+    size_t max = atomic_load_explicit(&max_request, memory_order_relaxed);
+    while (size > max &&
+           !atomic_compare_exchange_weak(&max_request, &max, size))
+    { }
+}
+
+// The largest request size in the class holding the `q`th quantile,
+// which is an upper bound on the quantile itself.
+static size_t
+quantile(size_t total, double q)
+{
+    size_t rank = (size_t) (q * (double) total), seen = 0;
+
+    for (size_t k = 0; k < CLASSES; ++k) {
+        seen += classes[k].count;
+        if (seen > rank) {
+            size_t max = class_max(k);
+            return max < max_request ? max : max_request;
+        }
+    }
+
+    return max_request;
+}
+
+static void
+dump_histogram(void)
+{
+    static struct { char const* name; double q; } const percentiles[] = {
+        { "p50",  0.50 },
+        { "p90",  0.90 },
+        { "p99",  0.99 },
+        { "p999", 0.999 },
+    };
+
+    if (getpid() != owner) return;
+
+    FILE* out = histogram_out;
+    size_t requests = 0, bytes = 0, slack = 0;
+
+    for (size_t k = 0; k < CLASSES; ++k) {
+        requests += classes[k].count;
+        bytes    += classes[k].bytes;
+        slack    += classes[k].slack;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"requests\": %zu,\n", requests);
+    fprintf(out, "  \"requested_bytes\": %zu,\n", bytes);
+    fprintf(out, "  \"slack_bytes\": %zu,\n", slack);
+    fprintf(out, "  \"max_request\": %zu,\n", (size_t) max_request);
+
+    fprintf(out, "  \"percentiles\": {");
+    for (size_t i = 0; i < sizeof percentiles / sizeof *percentiles; ++i) {
+        fprintf(out, "%s\n    \"%s\": %zu", i ? "," : "",
+                percentiles[i].name,
+                requests ? quantile(requests, percentiles[i].q) : 0);
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"classes\": [");
+    bool first = true;
+    for (size_t k = 0; k < CLASSES; ++k) {
+        if (!classes[k].count) continue;
+
+        fprintf(out, "%s\n    { \"min\": %zu, \"max\": %zu, \"count\": %zu, "
+                     "\"bytes\": %zu, \"slack\": %zu }",
+                first ? "" : ",",
+                class_min(k), class_max(k),
+                (size_t) classes[k].count,
+                (size_t) classes[k].bytes,
+                (size_t) classes[k].slack);
+        first = false;
+    }
+    fprintf(out, "%s]\n}\n", first ? "" : "\n  ");
+
+    rt211_env_close(out);
+    histogram_out = NULL;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// A log2 size-class histogram of allocation requests, with the slack
+// (usable size minus requested size) that the underlying allocator
+// adds to each. Setting RT211_ALLOC_HISTOGRAM (to a file name or `&fd`)
+// turns it on and writes it as JSON at exit.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Is the histogram turned on?
+bool rt211_histogram_enabled(void);
+
+// Counts a successful request for `size` bytes that got a block with
+// `usable` bytes.
+void rt211_histogram_add(size_t size, size_t usable);
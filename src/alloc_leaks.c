@@ -0,0 +1,119 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_leaks.h"
+#include "alloc_sites.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static pthread_once_t leaks_once = PTHREAD_ONCE_INIT;
+static FILE* leaks_out = NULL;
+static pid_t owner;                 // only this process reports
+
+// Blocks of the same size from the same site.
+struct leak_group
+{
+    struct alloc_site const* site;
+    size_t size;
+    size_t blocks;
+};
+
+static void
+leaks_init(void)
+{
+    leaks_out = rt211_env_output("RT211_ALLOC_LEAKS");
+    owner     = getpid();
+}
+
+bool rt211_leaks_enabled(void)
+{
+    pthread_once(&leaks_once, &leaks_init);
+    return leaks_out != NULL;
+}
+
+static int
+compare_by_site_and_size(void const* a, void const* b)
+{
+    struct alloc_record const *x = a, *y = b;
+
+    if (x->site != y->site)
+        return (uintptr_t) x->site < (uintptr_t) y->site ? -1 : 1;
+
+    return x->size < y->size ? -1 : x->size > y->size ? 1 : 0;
+}
+
+static int
+compare_by_bytes(void const* a, void const* b)
+{
+    struct leak_group const *x = a, *y = b;
+    size_t m = x->size * x->blocks,
+           n = y->size * y->blocks;
+    return m < n ? 1 : m > n ? -1 : 0;
+}
+
+bool rt211_blocks_print(FILE* out, struct alloc_record* recs, size_t count)
+{
+    struct leak_group* groups = malloc((count ? count : 1) * sizeof *groups);
+    if (!groups) return false;
+
+    qsort(recs, count, sizeof *recs, &compare_by_site_and_size);
+
+    size_t ngroups = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct leak_group* last = ngroups ? &groups[ngroups - 1] : NULL;
+
+        if (last && last->site == recs[i].site && last->size == recs[i].size)
+            ++last->blocks;
+        else
+            groups[ngroups++] = (struct leak_group) {
+                .site   = recs[i].site,
+                .size   = recs[i].size,
+                .blocks = 1,
+            };
+    }
+
+    qsort(groups, ngroups, sizeof *groups, &compare_by_bytes);
+
+    if (ngroups) {
+        fprintf(out, "%14s %10s %12s  %s\n",
+                "bytes", "blocks", "size", "site");
+    }
+
+    for (size_t i = 0; i < ngroups; ++i) {
+        char name[256] = "(unknown)";
+        if (groups[i].site) rt211_site_name(groups[i].site, name, sizeof name);
+
+        fprintf(out, "%14zu %10zu %12zu  %s\n",
+                groups[i].size * groups[i].blocks,
+                groups[i].blocks,
+                groups[i].size,
+                name);
+    }
+
+    free(groups);
+    return true;
+}
+
+void rt211_leaks_report(struct alloc_record* recs, size_t count)
+{
+    if (!leaks_out || getpid() != owner) return;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += recs[i].size;
+
+    fprintf(leaks_out,
+            "lib211_alloc: %zu bytes in %zu blocks still allocated at exit\n",
+            total, count);
+
+    if (!rt211_blocks_print(leaks_out, recs, count))
+        perror("lib211_alloc");
+
+    rt211_env_close(leaks_out);
+    leaks_out = NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// The exit-time leak report. Setting RT211_ALLOC_LEAKS (to a file name
+// or `&fd`) makes lib211 track every block, and at exit it lists those
+// still allocated, grouped by size and call site and sorted by bytes.
+// Unlike LeakSanitizer, this works in the unsanitized library too.
+
+#include "alloc_table.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Does the user want a leak report?
+bool rt211_leaks_enabled(void);
+
+// Reports the `count` blocks in `recs` as leaked. May reorder `recs`.
+void rt211_leaks_report(struct alloc_record* recs, size_t count);
+
+// Prints the `count` blocks in `recs` to `out` as a table, grouped by
+// size and call site and sorted by bytes. May reorder `recs`. Returns
+// false if there wasn't memory to do so.
+bool rt211_blocks_print(FILE* out, struct alloc_record* recs, size_t count);
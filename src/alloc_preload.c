@@ -0,0 +1,301 @@
+// Interposes the C library's allocation functions, so that allocation
+// limits, tracing and the rest work on programs that weren't compiled
+// against lib211_alloc.h:
+//
+//     LD_PRELOAD=lib211-preload.so RT211_ALLOC_LIMIT_PEAK=1M ./prog
+//
+// The rest of the preload library is compiled with malloc and friends
+// renamed to rt211_real_malloc and so on (see PRELOADFLAG in the
+// Makefile), which we define here to call the next definition in
+// line, found with dlsym(3). Anything the C library allocates while
+// we're already inside a wrapper (e.g., for fopen(3) when tracing
+// starts) goes straight to the real allocator too.
+
+#define _GNU_SOURCE
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef aligned_alloc
+#undef posix_memalign
+#undef malloc_usable_size
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+void* rt211_malloc(size_t);
+void* rt211_calloc(size_t, size_t);
+void* rt211_realloc(void*, size_t);
+void* rt211_reallocf(void*, size_t);
+void  rt211_free(void*);
+void* rt211_aligned_alloc(size_t, size_t);
+int   rt211_posix_memalign(void**, size_t, size_t);
+size_t rt211_malloc_usable_size(void*);
+void  rt211_alloc_init(void);
+
+static void* (*real_malloc)(size_t);
+static void* (*real_calloc)(size_t, size_t);
+static void* (*real_realloc)(void*, size_t);
+static void  (*real_free)(void*);
+static int   (*real_posix_memalign)(void**, size_t, size_t);
+static size_t (*real_malloc_usable_size)(void*);
+
+// Set while this thread is inside one of our wrappers. This must be
+// initial-exec TLS, since the general model may allocate on first use.
+static _Thread_local bool in_hook __attribute__((tls_model("initial-exec")));
+
+// dlsym(3) may itself allocate, so while we're looking up the real
+// functions, we hand out memory from a static buffer, which is never
+// freed.
+#define BOOTSTRAP_SIZE  8192
+
+static _Alignas(max_align_t) unsigned char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrap_used = 0;
+static bool   resolving      = false;
+
+static void* bootstrap_alloc(size_t n)
+{
+    size_t align = _Alignof(max_align_t);
+    n = (n + align - 1) & ~(align - 1);
+
+    if (n > BOOTSTRAP_SIZE - bootstrap_used) return NULL;
+
+    void* result = bootstrap + bootstrap_used;
+    bootstrap_used += n;
+    return result;
+}
+
+static bool is_bootstrap(void const* p)
+{
+    return (unsigned char const*) p >= bootstrap &&
+           (unsigned char const*) p < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void die(char const* msg)
+{
+    write(STDERR_FILENO, msg, strlen(msg));
+    _exit(255);
+}
+
+static void resolve(void)
+{
+    if (real_free) return;
+
+    resolving    = true;
+    // POSIX's workaround for converting from `void*`; see dlsym(3).
+    *(void**) &real_malloc  = dlsym(RTLD_NEXT, "malloc");
+    *(void**) &real_calloc  = dlsym(RTLD_NEXT, "calloc");
+    *(void**) &real_realloc = dlsym(RTLD_NEXT, "realloc");
+    *(void**) &real_free    = dlsym(RTLD_NEXT, "free");
+    *(void**) &real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    *(void**) &real_malloc_usable_size =
+            dlsym(RTLD_NEXT, "malloc_usable_size");
+    resolving    = false;
+
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free ||
+            !real_posix_memalign || !real_malloc_usable_size)
+        die("lib211-preload: could not find the real allocator\n");
+}
+
+__attribute__((constructor))
+static void preload_init(void)
+{
+    resolve();
+
+    // Setting up may open files and so on, which must not come back
+    // through our wrappers.
+    in_hook = true;
+    rt211_alloc_init();
+    in_hook = false;
+}
+
+///
+/// THE REAL ALLOCATOR, FOR LIB211'S OWN USE
+///
+
+void* rt211_real_malloc(size_t n)
+{
+    if (resolving) return bootstrap_alloc(n);
+    resolve();
+    return real_malloc(n);
+}
+
+void* rt211_real_calloc(size_t nmemb, size_t size)
+{
+    // The bootstrap buffer is never reused, so it's still zeroed.
+    if (resolving)
+        return nmemb && size > SIZE_MAX / nmemb
+               ? NULL : bootstrap_alloc(nmemb * size);
+    resolve();
+    return real_calloc(nmemb, size);
+}
+
+void* rt211_real_realloc(void* p, size_t n)
+{
+    if (is_bootstrap(p)) {
+        // We don't know the old size, but it can't extend past the end
+        // of the buffer.
+        size_t room = (size_t) (bootstrap + BOOTSTRAP_SIZE -
+                                (unsigned char*) p);
+        void* q = rt211_real_malloc(n);
+        if (q) memcpy(q, p, n < room ? n : room);
+        return q;
+    }
+
+    if (resolving) return p ? NULL : bootstrap_alloc(n);
+    resolve();
+    return real_realloc(p, n);
+}
+
+void rt211_real_free(void* p)
+{
+    if (!p || is_bootstrap(p)) return;
+    resolve();
+    real_free(p);
+}
+
+int rt211_real_posix_memalign(void** memptr, size_t align, size_t n)
+{
+    if (resolving) return ENOMEM;
+    resolve();
+    return real_posix_memalign(memptr, align, n);
+}
+
+size_t rt211_real_malloc_usable_size(void* p)
+{
+    // We don't know how much of the bootstrap buffer is whose.
+    if (!p || is_bootstrap(p)) return 0;
+    resolve();
+    return real_malloc_usable_size(p);
+}
+
+///
+/// INTERPOSED FUNCTIONS
+///
+
+void* malloc(size_t n)
+{
+    if (in_hook || resolving) return rt211_real_malloc(n);
+
+    in_hook = true;
+    void* result = rt211_malloc(n);
+    in_hook = false;
+    return result;
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (in_hook || resolving) return rt211_real_calloc(nmemb, size);
+
+    in_hook = true;
+    void* result = rt211_calloc(nmemb, size);
+    in_hook = false;
+    return result;
+}
+
+void* realloc(void* p, size_t n)
+{
+    if (in_hook || resolving || is_bootstrap(p))
+        return rt211_real_realloc(p, n);
+
+    in_hook = true;
+    void* result = rt211_realloc(p, n);
+    in_hook = false;
+    return result;
+}
+
+void* reallocf(void* p, size_t n)
+{
+    if (in_hook || resolving || is_bootstrap(p)) {
+        void* result = rt211_real_realloc(p, n);
+        if (!result) rt211_real_free(p);
+        return result;
+    }
+
+    in_hook = true;
+    void* result = rt211_reallocf(p, n);
+    in_hook = false;
+    return result;
+}
+
+void* aligned_alloc(size_t align, size_t n)
+{
+    if (in_hook || resolving) {
+        void* result;
+        int   error = rt211_real_posix_memalign(
+                &result, align < sizeof result ? sizeof result : align, n);
+        if (!error) return result;
+        errno = error;
+        return NULL;
+    }
+
+    in_hook = true;
+    void* result = rt211_aligned_alloc(align, n);
+    in_hook = false;
+    return result;
+}
+
+// The obsolete aligned allocators. Unlike aligned_alloc(3), memalign(3)
+// takes any power of two, even one smaller than a pointer.
+void* memalign(size_t align, size_t n)
+{
+    return aligned_alloc(align < sizeof(void*) ? sizeof(void*) : align, n);
+}
+
+void* valloc(size_t n)
+{
+    return memalign((size_t) sysconf(_SC_PAGESIZE), n);
+}
+
+void* pvalloc(size_t n)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    if (n > SIZE_MAX - (page - 1)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return memalign(page, (n + page - 1) & ~(page - 1));
+}
+
+int posix_memalign(void** memptr, size_t align, size_t n)
+{
+    if (in_hook || resolving)
+        return rt211_real_posix_memalign(memptr, align, n);
+
+    in_hook = true;
+    int result = rt211_posix_memalign(memptr, align, n);
+    in_hook = false;
+    return result;
+}
+
+void free(void* p)
+{
+    if (in_hook || resolving || is_bootstrap(p)) {
+        rt211_real_free(p);
+        return;
+    }
+
+    in_hook = true;
+    rt211_free(p);
+    in_hook = false;
+}
+
+size_t malloc_usable_size(void* p)
+{
+    if (in_hook || resolving || is_bootstrap(p))
+        return rt211_real_malloc_usable_size(p);
+
+    in_hook = true;
+    size_t result = rt211_malloc_usable_size(p);
+    in_hook = false;
+    return result;
+}
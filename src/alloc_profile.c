@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include "211_alloc_stats.h"
+#include "alloc_env.h"
+#include "alloc_profile.h"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The deepest stack we record.
+#define MAX_FRAMES      32
+
+// The most frames we expect to drop from the top of each stack: ours,
+// whichever allocation functions led here, ASan's interceptor for
+// backtrace(3), and the preload library's wrappers.
+#define MAX_SKIPPED     16
+
+// If lib211 is linked statically, so that its code can't be told from
+// the program's (see `find_own_code`), we drop this many frames instead:
+// ours, the dispatcher's, and the `_at` entry point's, plus ASan's
+// interceptor if it's there. Calls from elsewhere will show a frame or
+// two of lib211 at the top.
+#ifdef __SANITIZE_ADDRESS__
+#   define SKIP_FRAMES  4
+#else
+#   define SKIP_FRAMES  3
+#endif
+
+// Stacks and live blocks each go in a chained hash table, and every
+// LOCK_STRIPES-th bucket shares a lock.
+#define STACK_BUCKETS   ((size_t) 1 << 12)
+#define BLOCK_BUCKETS   ((size_t) 1 << 14)
+#define LOCK_STRIPES    64
+
+// A distinct stack and what's been allocated from it. Stacks are never
+// freed.
+struct stack
+{
+    struct stack* next;
+    uint64_t      hash;
+
+    _Atomic size_t inuse_objects;
+    _Atomic size_t inuse_bytes;
+    _Atomic size_t alloc_objects;
+    _Atomic size_t alloc_bytes;
+
+    size_t depth;
+    void*  frames[];
+};
+
+// A live block and the stack that allocated it.
+struct block
+{
+    struct block* next;
+    void const*   pointer;
+    size_t        size;
+    struct stack* stack;
+};
+
+static struct stack*   stacks[STACK_BUCKETS];
+static pthread_mutex_t stack_locks[LOCK_STRIPES];
+
+static struct block*   blocks[BLOCK_BUCKETS];
+static pthread_mutex_t block_locks[LOCK_STRIPES];
+
+static pthread_once_t  profile_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t output_lock  = PTHREAD_MUTEX_INITIALIZER;
+static FILE* profile_out = NULL;
+static pid_t owner;
+
+// The span of lib211's own code, or 0 and 0 if it's part of the program.
+static uintptr_t own_code_lo, own_code_hi;
+
+static void write_profile_at_exit(void);
+
+static void
+lock_all(void)
+{
+    pthread_mutex_lock(&output_lock);
+
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_mutex_lock(&stack_locks[i]);
+        pthread_mutex_lock(&block_locks[i]);
+    }
+}
+
+static void
+unlock_all(void)
+{
+    for (size_t i = LOCK_STRIPES; i-- > 0; ) {
+        pthread_mutex_unlock(&block_locks[i]);
+        pthread_mutex_unlock(&stack_locks[i]);
+    }
+
+    pthread_mutex_unlock(&output_lock);
+}
+
+// A dl_iterate_phdr(3) callback that, if `info` is the object holding
+// address `aux`, records the span of its code in `own_code_lo` and
+// `own_code_hi`, unless it's the program itself (whose name is empty).
+static int
+find_own_code(struct dl_phdr_info* info, size_t size, void* aux)
+{
+    (void) size;
+
+    uintptr_t here  = (uintptr_t) aux;
+    uintptr_t lo    = UINTPTR_MAX, hi = 0;
+    bool      found = false;
+
+    for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+        ElfW(Phdr) const* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) continue;
+
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        uintptr_t end   = start + phdr->p_memsz;
+
+        if (start <= here && here < end) found = true;
+
+        if (phdr->p_flags & PF_X) {
+            if (start < lo) lo = start;
+            if (end > hi)   hi = end;
+        }
+    }
+
+    if (!found) return 0;
+
+    if (info->dlpi_name[0] && lo < hi) {
+        own_code_lo = lo;
+        own_code_hi = hi;
+    }
+
+    return 1;
+}
+
+// Is return address `frame` in lib211's code? (It may point just past
+// the end, after a call that never returns.)
+static bool
+is_own_frame(void* frame)
+{
+    uintptr_t a = (uintptr_t) frame - 1;
+    return own_code_lo <= a && a < own_code_hi;
+}
+
+// How many frames at the top of a stack are lib211's: any that
+// backtrace(3) itself adds, and then all of lib211's own, however many
+// wrappers the call went through.
+static int
+frames_to_skip(void* const* frames, int depth)
+{
+    if (!own_code_hi) return depth > SKIP_FRAMES ? SKIP_FRAMES : depth;
+
+    int i = 0;
+    while (i < depth && !is_own_frame(frames[i])) ++i;
+    if (i == depth) return 0;
+    while (i < depth && is_own_frame(frames[i])) ++i;
+
+    return i;
+}
+
+static void
+profile_init(void)
+{
+    profile_out = rt211_env_output("RT211_HEAP_PROFILE");
+    if (!profile_out) return;
+
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        pthread_mutex_init(&stack_locks[i], NULL);
+        pthread_mutex_init(&block_locks[i], NULL);
+    }
+
+    if (pthread_atfork(&lock_all, &unlock_all, &unlock_all)) {
+        perror("lib211_alloc");
+        exit(255);
+    }
+
+    dl_iterate_phdr(&find_own_code, &profile_out);
+
+    // The first backtrace(3) loads the unwinder, which allocates, so
+    // get that over with now.
+    void* frame;
+    backtrace(&frame, 1);
+
+    owner = getpid();
+    atexit(&write_profile_at_exit);
+}
+
+bool rt211_profile_enabled(void)
+{
+    pthread_once(&profile_once, &profile_init);
+    return profile_out != NULL;
+}
+
+static uint64_t
+hash_frames(void* const* frames, size_t depth)
+{
+    uint64_t h = depth;
+
+    for (size_t i = 0; i < depth; ++i)
+        h = (h ^ (uint64_t) (uintptr_t) frames[i])
+            * UINT64_C(0x9e3779b97f4a7c15);
+
+    return h;
+}
+
+// Finds or adds the record for the stack in `frames`.
+static struct stack*
+intern_stack(void* const* frames, size_t depth)
+{
+    uint64_t h = hash_frames(frames, depth);
+    size_t   i = (size_t) (h >> 32) & (STACK_BUCKETS - 1);
+    struct stack* found;
+
+    pthread_mutex_lock(&stack_locks[i % LOCK_STRIPES]);
+
+    for (found = stacks[i]; found; found = found->next) {
+        if (found->hash == h && found->depth == depth &&
+                !memcmp(found->frames, frames, depth * sizeof *frames))
+            break;
+    }
+
+    if (!found) {
+        found = calloc(1, sizeof *found + depth * sizeof *frames);
+
+        if (found) {
+            found->hash  = h;
+            found->depth = depth;
+            memcpy(found->frames, frames, depth * sizeof *frames);
+            found->next  = stacks[i];
+            stacks[i]    = found;
+        }
+    }
+
+    pthread_mutex_unlock(&stack_locks[i % LOCK_STRIPES]);
+    return found;
+}
+
+static size_t
+block_bucket_of(void const* p)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p * UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t) (h >> 32) & (BLOCK_BUCKETS - 1);
+}
+
+void rt211_profile_alloc(void const* p, size_t size)
+{
+    int   saved_errno = errno;
+    void*  frames[MAX_SKIPPED + MAX_FRAMES];
+    int    depth = backtrace(frames, MAX_SKIPPED + MAX_FRAMES);
+    int    skip  = frames_to_skip(frames, depth);
+    size_t kept  = (size_t) (depth - skip);
+
+    if (kept > MAX_FRAMES) kept = MAX_FRAMES;
+
+    struct stack* stack = intern_stack(frames + skip, kept);
+    struct block* block = malloc(sizeof *block);
+
+    if (!stack || !block) {
+        free(block);
+        errno = saved_errno;
+        return;
+    }
+
+    atomic_fetch_add_explicit(&stack->inuse_objects, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stack->inuse_bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stack->alloc_objects, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stack->alloc_bytes, size, memory_order_relaxed);
+
+    *block = (struct block) { NULL, p, size, stack };
+
+    size_t i = block_bucket_of(p);
+    pthread_mutex_lock(&block_locks[i % LOCK_STRIPES]);
+    block->next = blocks[i];
+    blocks[i]   = block;
+    pthread_mutex_unlock(&block_locks[i % LOCK_STRIPES]);
+
+    errno = saved_errno;
+}
+
+void rt211_profile_free(void const* p)
+{
+    if (!p) return;
+
+    size_t i = block_bucket_of(p);
+    struct block* found = NULL;
+
+    pthread_mutex_lock(&block_locks[i % LOCK_STRIPES]);
+
+    for (struct block** link = &blocks[i]; *link; link = &(*link)->next) {
+        if ((*link)->pointer == p) {
+            found = *link;
+            *link = found->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&block_locks[i % LOCK_STRIPES]);
+
+    if (!found) return;
+
+    struct stack* stack = found->stack;
+    atomic_fetch_sub_explicit(&stack->inuse_objects, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&stack->inuse_bytes, found->size,
+                              memory_order_relaxed);
+    free(found);
+}
+
+static void
+copy_maps(FILE* out)
+{
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (!maps) return;
+
+    char   buf[4096];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof buf, maps)))
+        fwrite(buf, 1, n, out);
+
+    fclose(maps);
+}
+
+// Returns the first stack in bucket `i`. New stacks only ever go on
+// the front, so the rest of the chain is safe to read without a lock.
+static struct stack*
+first_stack(size_t i)
+{
+    pthread_mutex_lock(&stack_locks[i % LOCK_STRIPES]);
+    struct stack* s = stacks[i];
+    pthread_mutex_unlock(&stack_locks[i % LOCK_STRIPES]);
+    return s;
+}
+
+static void
+write_profile(FILE* out)
+{
+    size_t inuse_objects = 0, inuse_bytes = 0,
+           alloc_objects = 0, alloc_bytes = 0;
+
+    for (size_t i = 0; i < STACK_BUCKETS; ++i) {
+        for (struct stack* s = first_stack(i); s; s = s->next) {
+            inuse_objects += s->inuse_objects;
+            inuse_bytes   += s->inuse_bytes;
+            alloc_objects += s->alloc_objects;
+            alloc_bytes   += s->alloc_bytes;
+        }
+    }
+
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heapprofile\n",
+            inuse_objects, inuse_bytes, alloc_objects, alloc_bytes);
+
+    for (size_t i = 0; i < STACK_BUCKETS; ++i) {
+        for (struct stack* s = first_stack(i); s; s = s->next) {
+            fprintf(out, "%zu: %zu [%zu: %zu] @",
+                    (size_t) s->inuse_objects, (size_t) s->inuse_bytes,
+                    (size_t) s->alloc_objects, (size_t) s->alloc_bytes);
+
+            for (size_t j = 0; j < s->depth; ++j)
+                fprintf(out, " %p", s->frames[j]);
+
+            fputc('\n', out);
+        }
+    }
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    copy_maps(out);
+    fflush(out);
+}
+
+bool alloc_profile_write(FILE* out)
+{
+    if (!rt211_profile_enabled()) return false;
+
+    pthread_mutex_lock(&output_lock);
+    if (profile_out) write_profile(out);
+    pthread_mutex_unlock(&output_lock);
+    return true;
+}
+
+static void
+write_profile_at_exit(void)
+{
+    if (getpid() != owner) return;
+
+    pthread_mutex_lock(&output_lock);
+    write_profile(profile_out);
+    rt211_env_close(profile_out);
+    profile_out = NULL;
+    pthread_mutex_unlock(&output_lock);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Heap profiles by stack. Setting RT211_HEAP_PROFILE (to a file name or
+// `&fd`) makes each allocation record its caller's stack, and at exit
+// (or on alloc_profile_write(3)) writes in-use and allocated bytes and
+// objects per stack in pprof's legacy heap profile format, followed by
+// the process's memory map. The addresses are left for pprof to
+// symbolize.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Is profiling turned on?
+bool rt211_profile_enabled(void);
+
+// Notes that block `p` of `size` bytes was just allocated. Records the
+// current stack, so call this directly from the allocation wrapper.
+void rt211_profile_alloc(void const* p, size_t size);
+
+// Notes that block `p` is about to be freed.
+void rt211_profile_free(void const* p);
@@ -4,17 +4,30 @@
 
 #include "211_alloc_limit.h"
 #include "211.h"
+#include "alloc_env.h"
+#include "alloc_explore.h"
+#include "alloc_growth.h"
+#include "alloc_guard.h"
+#include "alloc_histogram.h"
+#include "alloc_leaks.h"
+#include "alloc_profile.h"
+#include "alloc_sites.h"
+#include "alloc_snapshot.h"
+#include "alloc_stats.h"
+#include "alloc_table.h"
+#include "alloc_timeline.h"
+#include "alloc_trace.h"
 
-#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
-#include <stdarg.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdlib.h>
-#include <stdnoreturn.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -26,398 +39,1566 @@
 #define EV_TOTAL2 "RT211_ALLOC_LIMIT"
 
 ///
-/// TRACING
+/// ALLOCATION INSTRUMENTATION
 ///
 
-static bool trace_is_init = false;
-static FILE* trace_out    = NULL;
+// The state of the allocation limit system:
+enum limit_state
+{
+    UNINITIALIZED,
+    NO_LIMIT,
+    LIMIT_TOTAL, // limit total bytes allocated ever (free irrelevant)
+    LIMIT_PEAK   // limit total bytes allocated at once (free helps)
+};
+
+static _Atomic enum limit_state alloc_limit_state = UNINITIALIZED;
+
+// Remaining bytes allowed to allocate, not counting budget that threads
+// have cached locally (see `struct local_budget` below). If the state is
+// LIMIT_PEAK then free() adds to this, whereas with LIMIT_TOTAL this
+// number is monotone decreasing (unless you reset it explicitly).
+static _Atomic size_t bytes_remaining;
+
+// Bumped whenever the limit is reset. This invalidates budget cached by
+// threads under the old limit, and (in header mode) stops blocks charged
+// against the old limit from being credited to the new one.
+static _Atomic uint32_t limit_epoch = 1;
+
+// Nested limits from alloc_limit_push(3), outermost first, which apply
+// on top of the limit above. Each frame gets its own epoch from the same
+// sequence as `limit_epoch`, and each block records the epoch of the
+// innermost frame at the time it was allocated. Since a frame can only
+// be popped after every frame pushed later, the frames still in effect
+// that charged for a block are exactly those whose epochs are no later
+// than the block's.
+#define MAX_LIMIT_DEPTH  32
+
+static struct limit_frame
+{
+    enum limit_state kind;      // LIMIT_TOTAL or LIMIT_PEAK
+    _Atomic size_t   remaining;
+    uint32_t         epoch;
+}       limit_frames[MAX_LIMIT_DEPTH];
+
+static _Atomic size_t limit_depth = 0;
+static _Atomic size_t peak_frames = 0;     // how many are LIMIT_PEAK
+
+// The epoch of the innermost frame, or `limit_epoch` if there are none.
+static _Atomic uint32_t scope_epoch = 1;
+
+// The latest epoch handed out, protected by `limit_lock`.
+static uint32_t last_epoch = 1;
+
+// Serializes resetting the limit.
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t alloc_limit_once    = PTHREAD_ONCE_INIT;
+static pthread_once_t thread_support_once = PTHREAD_ONCE_INIT;
+
+// Whether we're keeping per-call-site statistics, which means tracking
+// every block regardless of the limit state.
+static bool track_sites = false;
+
+// Whether to report leaks at exit, which means keeping every block in
+// `allocation_table`, even in header mode.
+static bool track_leaks = false;
+
+// Whether alloc_snapshot_take(3) has been called, which likewise means
+// keeping every block in `allocation_table` from then on.
+static _Atomic bool track_snapshots = false;
+
+// The generation that new blocks are stamped with. Each snapshot starts
+// a new one, so a block's generation says which snapshots it follows.
+static _Atomic uint32_t snapshot_generation = 1;
+
+// Whether to keep the request size histogram.
+static bool track_sizes = false;
+
+// Whether to fork at each allocation (see alloc_explore.h).
+static bool explore_allocs = false;
+
+// Whether to follow how reallocs grow blocks (see alloc_growth.h).
+static bool track_growth = false;
+
+// Whether to snapshot live bytes over time (see alloc_timeline.h).
+static bool track_timeline = false;
+
+// Whether to record each block's stack (see alloc_profile.h).
+static bool track_profile = false;
+
+// Whether new blocks come from the guard allocator (see alloc_guard.h),
+// which surrounds them with redzones and poisons and quarantines them
+// on free. Set once from RT211_ALLOC_GUARD in `thread_support_init`;
+// only the `base_` functions below look at it, so blocks from before
+// then still go back to the C library. In header mode our header sits
+// inside the guarded block, so we hand the guard allocator `BASE_OF(p)`
+// and tell it where the user's part starts (`set_guard_prefix`). A
+// freed block keeps its inverted cookie while it sits in quarantine,
+// which is how `is_freed_guarded` sends a double free to the guard
+// allocator to report instead of treating it as a foreign block.
+static bool guard_blocks = false;
+
+// The allocation functions for one configuration (see `alloc_ops`
+// below), so that the common case of no limit and no instrumentation
+// costs a single indirect call instead of a dozen checks.
+struct alloc_ops
+{
+    void* (*malloc)(size_t, char const*, int, char const*);
+    void* (*calloc)(size_t, size_t, char const*, int, char const*);
+    void* (*aligned_alloc)(size_t, size_t, char const*, int, char const*);
+    void* (*realloc)(void*, size_t, char const*, int, char const*);
+    void* (*reallocf)(void*, size_t, char const*, int, char const*);
+    void  (*free)(void*, char const*, int, char const*);
+};
+
+static void select_alloc_ops(void);
+
+#define TABLE_SHARDS  64
+
+// A map from every tracked pointer to its record. It's split into
+// shards with their own locks, so threads freeing different blocks
+// rarely contend. (In header mode, we only use it for leak reports and
+// snapshots.)
+static struct table_shard
+{
+    pthread_mutex_t    lock;
+    struct alloc_table table;
+}       allocation_table[TABLE_SHARDS];
 
 static void
-close_trace_out(void)
+alloc_limit_init_once(void)
 {
-    if (trace_out) {
-        fclose(trace_out);
-        trace_out = NULL;
-    }
+    size_t n;
+
+    // The user beat us to it.
+    if (alloc_limit_state != UNINITIALIZED) return;
+
+    if (rt211_env_size(EV_TOTAL, &n) || rt211_env_size(EV_TOTAL2, &n))
+        alloc_limit_set_total(n);
+
+    else if (rt211_env_size(EV_PEAK, &n) || rt211_env_size(EV_PEAK2, &n))
+        alloc_limit_set_peak(n);
+
+    else
+        alloc_limit_set_no_limit();
 }
 
+
+///
+/// PER-THREAD BUDGETS
+///
+
+// The most budget a thread takes from `bytes_remaining` beyond what it
+// needs right away. Keeping a little on hand means most allocations
+// under a limit never touch the shared counter.
+#define LOCAL_BUDGET_BATCH  ((size_t) 64 << 10)
+
+// Budget a thread has drawn from `bytes_remaining` but not yet used.
+// Since the shared counter only ever hands out what it has, a single-
+// threaded program sees exactly the limit it asked for. With several
+// threads, an allocation may fail while other threads hold up to
+// `LOCAL_BUDGET_BATCH` bytes each.
+static _Thread_local struct local_budget
+{
+    size_t   bytes;
+    uint32_t epoch;         // the limit `bytes` belongs to
+    bool     registered;    // for return at thread exit
+}       local_budget;
+
+static pthread_key_t local_budget_key;
+
 static void
-tracing_init_once(void)
+return_local_budget(void* unused)
 {
-    if (trace_is_init) return;
+    (void) unused;
+
+    if (local_budget.epoch == limit_epoch)
+        atomic_fetch_add(&bytes_remaining, local_budget.bytes);
+
+    local_budget.bytes = 0;
+}
 
-    atexit(&close_trace_out);
+static struct local_budget*
+my_budget(void)
+{
+    uint32_t epoch = limit_epoch;
 
-    const char* trace_dst = getenv("RT211_TRACE");
-    if (! trace_dst) {
-        // all set
-    } else if (trace_dst[0] == '&' && trace_dst[1] != 0) {
-        char* endptr;
-        long fd = strtol(&trace_dst[1], &endptr, 10);
-        if (*endptr == 0 && 0 <= fd && fd <= (long)INT_MAX) {
-            trace_out = fdopen((int)fd, "w");
+    if (local_budget.epoch != epoch) {
+        if (!local_budget.registered) {
+            pthread_setspecific(local_budget_key, &local_budget);
+            local_budget.registered = true;
         }
-    } else {
-        trace_out = fopen(trace_dst, "w");
+
+        local_budget.bytes = 0;
+        local_budget.epoch = epoch;
     }
 
-    trace_is_init = true;
+    return &local_budget;
 }
 
+// Takes `n` bytes of budget, or returns false if there isn't enough.
 static bool
-alloc_trace_is_enabled(void)
+budget_charge(size_t n)
 {
-    tracing_init_once();
-    return trace_out != NULL;
+    struct local_budget* mine = my_budget();
+
+    if (n <= mine->bytes) {
+        mine->bytes -= n;
+        return true;
+    }
+
+    size_t want  = n - mine->bytes;
+    size_t avail = atomic_load_explicit(&bytes_remaining,
+                                        memory_order_relaxed);
+    size_t take;
+
+    do {
+        if (avail < want) return false;
+
+        // Leave at least half of the surplus for other threads.
+        size_t spare = (avail - want) / 2;
+        take = want + (spare < LOCAL_BUDGET_BATCH ? spare : LOCAL_BUDGET_BATCH);
+    } while (!atomic_compare_exchange_weak(&bytes_remaining, &avail,
+                                           avail - take));
+
+    mine->bytes += take - n;
+    return true;
 }
 
+// Gives back `n` bytes of budget.
 static void
-alloc_tracef(char const* format, ...)
+budget_credit(size_t n)
 {
-    if (!alloc_trace_is_enabled()) return;
+    struct local_budget* mine = my_budget();
+
+    mine->bytes += n;
 
-    va_list ap;
-    va_start(ap, format);
-    vfprintf(trace_out, format, ap);
-    va_end(ap);
-    fprintf(trace_out, "\n");
+    if (mine->bytes > 2 * LOCAL_BUDGET_BATCH) {
+        size_t excess = mine->bytes - LOCAL_BUDGET_BATCH;
+        mine->bytes  -= excess;
+        atomic_fetch_add(&bytes_remaining, excess);
+    }
+}
+
+// How much budget this thread could get right now.
+static size_t
+budget_available(void)
+{
+    return my_budget()->bytes + bytes_remaining;
 }
 
 
 ///
-/// ALLOCATION INSTRUMENTATION
+/// LIMIT ACCOUNTING
 ///
 
-// A linked list mapping pointers to allocation sizes.
-typedef struct alloc_record
+static bool is_limited(enum limit_state state)
 {
-    void*  pointer;
-    size_t size;
-    struct alloc_record* next;
-}       *alloc_list_t;
+    return state == LIMIT_TOTAL || state == LIMIT_PEAK;
+}
 
-// The state of the allocation limit system:
-static enum {
-    UNINITIALIZED,
-    NO_LIMIT,
-    LIMIT_TOTAL, // limit total bytes allocated ever (free irrelevant)
-    LIMIT_PEAK   // limit total bytes allocated at once (free helps)
-}       alloc_limit_state = UNINITIALIZED;
+// Is there any limit at all, including nested ones?
+static bool any_limit(enum limit_state state)
+{
+    return is_limited(state) || limit_depth;
+}
 
-// Remaining bytes allowed to allocate. If the state is LIMIT_PEAK then
-// free() adds to this, whereas with LIMIT_TOTAL this number is monotone
-// decreasing (unless you reset it explicitly).
-static size_t bytes_remaining;
+// Is the limit of `kind` and `epoch` holding a charge for block `old`
+// (if any) that it should give back when the block goes away?
+static bool
+holds_charge(enum limit_state kind, uint32_t epoch,
+             struct alloc_record const* old)
+{
+    return kind == LIMIT_PEAK && old && epoch <= old->epoch;
+}
 
-// A map from every allocated pointer to its size.
-static alloc_list_t allocation_list = NULL;
+// What replacing block `old` (if any) with `n` bytes costs the limit
+// of `kind` and `epoch`.
+static size_t
+limit_cost(enum limit_state kind, uint32_t epoch,
+           struct alloc_record const* old, size_t n)
+{
+    size_t held = holds_charge(kind, epoch, old) ? old->size : 0;
+    return n > held ? n - held : 0;
+}
 
-static noreturn void
-bad_env_var(char const* name, char const* value)
+// What replacing block `old` (if any) with `n` bytes costs a pushed
+// limit. A pushed peak limit only pays for growth, even of a block from
+// before the push, which stays charged to the limits it was charged to
+// before (see `charge_epoch`).
+static size_t
+frame_cost(struct limit_frame const* frame,
+           struct alloc_record const* old, size_t n)
 {
-    fprintf(stderr, "rt211_alloc: could not understand %s value: ‘%s’",
-            name, value);
-    exit(254);
+    size_t held = frame->kind == LIMIT_PEAK && old ? old->size : 0;
+    return n > held ? n - held : 0;
 }
 
 static bool
-get_limit(char const* const name, size_t* const out)
+frame_charge(struct limit_frame* frame, size_t n)
 {
-    char *const original = getenv(name),
-         *begin = original,
-         *end;
-    unsigned long size;
+    size_t avail = atomic_load_explicit(&frame->remaining,
+                                        memory_order_relaxed);
 
-    if (!begin) return false;
+    do {
+        if (avail < n) return false;
+    } while (!atomic_compare_exchange_weak(&frame->remaining, &avail,
+                                           avail - n));
 
-    while (isspace(*begin)) ++begin;
-    if (!*begin) return false;
-
-    size = strtoul(begin, &end, 10);
-    if (begin == end)
-        bad_env_var(name, original);
+    return true;
+}
 
-    while (isspace(*end)) ++end;
+// Charges every limit for replacing block `old` (NULL for a new
+// allocation) with `n` bytes. If any limit doesn't allow it, charges
+// nothing and returns false.
+static bool
+limit_charge(struct alloc_record const* old, size_t n)
+{
+    enum limit_state state = alloc_limit_state;
+    size_t depth   = limit_depth;
+    size_t charged = 0;     // frames charged so far, innermost first
+    size_t left;
+
+    for (; charged < depth; ++charged) {
+        struct limit_frame* frame = &limit_frames[depth - 1 - charged];
+        if (!frame_charge(frame, frame_cost(frame, old, n))) {
+            left = frame->remaining;
+            goto denied;
+        }
+    }
 
-    switch (*end) {
-    case 'B': case 'b': case 0:
-        *out = size;
+    if (!is_limited(state) ||
+            budget_charge(limit_cost(state, limit_epoch, old, n)))
         return true;
 
-    case 'K': case 'k':
-        *out = size << 10;
-        return true;
+    left = budget_available();
 
-    case 'M': case 'm':
-        *out = size << 20;
-        return true;
+denied:
+    while (charged-- > 0) {
+        struct limit_frame* frame = &limit_frames[depth - 1 - charged];
+        frame->remaining += frame_cost(frame, old, n);
+    }
 
-    case 'G': case 'g':
-        *out = size << 30;
-        return true;
+    rt211_trace_denied(n, left);
+    errno = ENOMEM;
+    return false;
+}
+
+// Gives back a charge from `limit_charge` whose allocation failed.
+static void
+limit_uncharge(struct alloc_record const* old, size_t n)
+{
+    enum limit_state state = alloc_limit_state;
+    size_t depth = limit_depth;
 
-    default:
-        bad_env_var(name, original);
+    for (size_t i = 0; i < depth; ++i) {
+        struct limit_frame* frame = &limit_frames[i];
+        frame->remaining += frame_cost(frame, old, n);
     }
+
+    if (is_limited(state))
+        budget_credit(limit_cost(state, limit_epoch, old, n));
 }
 
+// Credits the limits that charged for block `old` with however much
+// of it went away when it was replaced by `n` bytes (or freed, if 0).
 static void
-alloc_limit_init_once(void)
+limit_settle(struct alloc_record const* old, size_t n)
 {
-    size_t n;
+    if (old->size <= n) return;
 
-    if (get_limit(EV_TOTAL, &n) || get_limit(EV_TOTAL2, &n))
-        alloc_limit_set_total(n);
+    size_t freed = old->size - n;
+    size_t depth = limit_depth;
 
-    else if (get_limit(EV_PEAK, &n) || get_limit(EV_PEAK2, &n))
-        alloc_limit_set_peak(n);
+    for (size_t i = 0; i < depth; ++i) {
+        struct limit_frame* frame = &limit_frames[i];
+        if (holds_charge(frame->kind, frame->epoch, old))
+            frame->remaining += freed;
+    }
 
-    else
-        alloc_limit_set_no_limit();
+    if (holds_charge(alloc_limit_state, limit_epoch, old))
+        budget_credit(freed);
 }
 
-#define ENSURE_ALLOC_DEBUG_INIT() \
-    if (alloc_limit_state == UNINITIALIZED) alloc_limit_init_once()
+static void
+lock_all_shards(void)
+{
+    for (size_t i = 0; i < TABLE_SHARDS; ++i)
+        pthread_mutex_lock(&allocation_table[i].lock);
+}
 
-static alloc_list_t
-find_alloc_record(void* p)
+static void
+unlock_all_shards(void)
 {
-    for (alloc_list_t cur = allocation_list; cur; cur = cur->next) {
-        if (cur->pointer == p) {
-            return cur;
-        }
-    }
+    for (size_t i = TABLE_SHARDS; i-- > 0; )
+        pthread_mutex_unlock(&allocation_table[i].lock);
+}
 
-    return NULL;
+// Fork handlers, so that a child doesn't inherit a lock that some
+// other thread of the parent was holding.
+static void
+before_fork(void)
+{
+    pthread_mutex_lock(&limit_lock);
+    lock_all_shards();
 }
 
-static size_t
-lookup_and_forget_size(void* p)
+static void
+after_fork(void)
 {
-    size_t size = 0;
+    unlock_all_shards();
+    pthread_mutex_unlock(&limit_lock);
+}
 
-    for (alloc_list_t* cur = &allocation_list; *cur; cur = &(*cur)->next) {
-        if ((*cur)->pointer == p) {
-            alloc_list_t victim = *cur;
-            *cur = victim->next;
-            size = victim->size;
-            free(victim);
-            break;
-        }
-    }
+struct block_collector
+{
+    struct alloc_record* recs;
+    size_t               count;
+    uint32_t             from, to;      // generations
+};
 
-    return size;
+static void
+collect_block(struct alloc_record const* rec, void* aux)
+{
+    struct block_collector* collector = aux;
+
+    if (collector->from <= rec->generation && rec->generation < collector->to)
+        collector->recs[collector->count++] = *rec;
+}
+
+struct alloc_record*
+rt211_live_blocks(uint32_t from, uint32_t to, size_t* count)
+{
+    lock_all_shards();
+
+    size_t most = 0;
+    for (size_t i = 0; i < TABLE_SHARDS; ++i)
+        most += allocation_table[i].table.count +
+                allocation_table[i].table.old_count;
+
+    struct block_collector collector = {
+        .recs  = malloc((most ? most : 1) * sizeof *collector.recs),
+        .count = 0,
+        .from  = from,
+        .to    = to,
+    };
+
+    for (size_t i = 0; collector.recs && i < TABLE_SHARDS; ++i)
+        alloc_table_for_each(&allocation_table[i].table,
+                             &collect_block, &collector);
+
+    unlock_all_shards();
+
+    *count = collector.count;
+    return collector.recs;
 }
 
-static void forget_everything(void)
+static void
+report_leaks(void)
 {
-    alloc_list_t list = allocation_list;
-    allocation_list = NULL;
+    size_t count;
+    struct alloc_record* recs = rt211_live_blocks(0, UINT32_MAX, &count);
 
-    while (list) {
-        alloc_list_t victim = list;
-        list = list->next;
-        free(victim);
+    if (!recs) {
+        perror("lib211_alloc");
+        return;
     }
+
+    rt211_leaks_report(recs, count);
+    free(recs);
 }
 
-static void remember_allocation(void* p, size_t n)
+static void
+thread_support_init(void)
 {
-    alloc_list_t node = malloc(sizeof *node);
-    if (!node) {
+    if (pthread_key_create(&local_budget_key, &return_local_budget) ||
+            pthread_atfork(&before_fork, &after_fork, &after_fork))
+    {
         perror("lib211_alloc");
         exit(255);
     }
 
-    node->pointer = p;
-    node->size = n;
-    node->next = allocation_list;
-    allocation_list = node;
+    for (size_t i = 0; i < TABLE_SHARDS; ++i)
+        pthread_mutex_init(&allocation_table[i].lock, NULL);
+
+    track_sites = rt211_sites_enabled();
+    track_leaks = rt211_leaks_enabled();
+    track_sizes = rt211_histogram_enabled();
+    explore_allocs = rt211_explore_enabled();
+    track_growth = rt211_growth_enabled();
+    track_timeline = rt211_timeline_enabled();
+    track_profile = rt211_profile_enabled();
+    guard_blocks = rt211_guard_enabled();
+
+    if (track_leaks) atexit(&report_leaks);
 }
 
-static void forget_allocation(void* p)
+// Sets up everything but the limit: thread support, and whatever
+// instrumentation the environment asks for. This runs as a constructor,
+// so that allocating never has to check. (The preload library calls it
+// from its own constructor instead, once it can route the C library's
+// allocations around us.)
+void rt211_alloc_init(void)
 {
-    bytes_remaining += lookup_and_forget_size(p);
+    pthread_once(&thread_support_once, &thread_support_init);
 }
 
-static bool alloc_limit_may_alloc(size_t n)
+#ifndef LIB211_PRELOAD
+__attribute__((constructor))
+static void alloc_rt_constructor(void)
 {
-    if ((alloc_limit_state == LIMIT_TOTAL || alloc_limit_state == LIMIT_PEAK)
-            && n > bytes_remaining)
-    {
-        alloc_tracef(
-                "lib211_alloc: preventing allocation of %zu bytes "
-                "because\nremaining limit is %zu",
-                n, bytes_remaining);
-        errno = ENOMEM;
-        return false;
-    }
-
-    return true;
+    rt211_alloc_init();
 }
+#endif
 
-static void* alloc_limit_did_alloc(void* p, size_t n)
+uint32_t rt211_snapshot_start(void)
 {
-    if (!p) return NULL;
+    rt211_alloc_init();
+    rt211_sites_start();
+    pthread_mutex_lock(&limit_lock);
 
-    if (alloc_limit_state == LIMIT_PEAK)
-        remember_allocation(p, n);
+    track_snapshots = true;
+    select_alloc_ops();
+    uint32_t generation = ++snapshot_generation;
 
-    if (alloc_limit_state == LIMIT_PEAK ||
-            alloc_limit_state == LIMIT_TOTAL)
-        bytes_remaining -= n;
+    pthread_mutex_unlock(&limit_lock);
+    return generation;
+}
 
-    return p;
+
+///
+/// BLOCK STORAGE
+///
+
+// Underneath everything, blocks come from the C library, or from the
+// guard allocator (see alloc_guard.h) if it's on. Blocks from before it
+// came on, or from elsewhere, still go back to the C library.
+
+static void* base_malloc(size_t n)
+{
+    return guard_blocks ? rt211_guard_malloc(n) : malloc(n);
 }
 
-static void alloc_limit_will_free(void* p)
+static void* base_calloc(size_t nmemb, size_t size)
 {
-    if (!p) return;
+    return guard_blocks ? rt211_guard_calloc(nmemb, size) : calloc(nmemb, size);
+}
 
-    if (alloc_limit_state == LIMIT_PEAK)
-        forget_allocation(p);
+static int base_memalign(void** out, size_t align, size_t n)
+{
+    return guard_blocks ? rt211_guard_memalign(out, align, n)
+                        : posix_memalign(out, align, n);
+}
+
+static bool is_guarded(void const* p)
+{
+    return guard_blocks && p && rt211_guard_owns(p);
 }
 
+static void* base_realloc(void* p, size_t n)
+{
+    if (is_guarded(p)) return rt211_guard_realloc(p, n);
+    if (guard_blocks && !p) return rt211_guard_malloc(n);
+    return realloc(p, n);
+}
 
-///
-/// WRAPPERS FOR MALLOC/FREE API
-///
+static void base_free(void* p)
+{
+    if (is_guarded(p)) rt211_guard_free(p);
+    else free(p);
+}
 
-static inline void*
-realloc_with_total_limit(void *ptr, size_t new_size)
+static size_t base_usable_size(void* p)
 {
-    if (alloc_limit_may_alloc(new_size))
-        return alloc_limit_did_alloc(realloc(ptr, new_size), new_size);
-    else
-        return NULL;
+    return is_guarded(p) ? rt211_guard_size(p) : malloc_usable_size(p);
 }
 
-static inline void*
-realloc_with_peak_limit(void *ptr, size_t new_size)
+static struct table_shard*
+shard_of(void const* p)
+{
+    uint64_t h = (uint64_t) ((uintptr_t) p >> 4) * UINT64_C(0x9e3779b97f4a7c15);
+    return &allocation_table[h >> 58 & (TABLE_SHARDS - 1)];
+}
+
+static bool
+table_forget(void* p, struct alloc_record* out)
 {
-    alloc_list_t node = find_alloc_record(ptr);
-    size_t old_size   = node ? node->size : 0;
+    struct table_shard* shard = shard_of(p);
 
-    size_t needed = new_size > old_size ? new_size - old_size : 0;
-    if (!alloc_limit_may_alloc(needed))
-        return NULL;
+    pthread_mutex_lock(&shard->lock);
+    bool found = alloc_table_remove(&shard->table, p, out);
+    pthread_mutex_unlock(&shard->lock);
 
-    ptr = realloc(ptr, new_size);
-    if (!ptr)
-        return NULL;
+    return found;
+}
+
+static void
+table_remember(struct alloc_record const* rec)
+{
+    struct table_shard* shard = shard_of(rec->pointer);
 
-    // Unsigned arithmetic, so this works even when new_size < old_size:
-    size_t change_in_size = new_size - old_size;
+    pthread_mutex_lock(&shard->lock);
+    bool ok = alloc_table_insert(&shard->table, rec);
+    pthread_mutex_unlock(&shard->lock);
 
-    bytes_remaining -= change_in_size;
-    if (node) {
-        node->size  += change_in_size;
-    } else {
-        remember_allocation(ptr, new_size);
+    if (!ok) {
+        perror("lib211_alloc");
+        exit(255);
     }
-
-    return ptr;
 }
 
-#define DO_CALLOC(NMEMB, SIZE) \
-    (SIZE <= SIZE_MAX / NMEMB && \
-         alloc_limit_may_alloc(NMEMB * SIZE) \
-     ? alloc_limit_did_alloc(calloc(NMEMB, SIZE), NMEMB * SIZE) \
-     : NULL)
+#ifdef LIB211_ALLOC_HEADER
+
+// Every block we hand out is preceded by a header recording its size,
+// so we never need a side table to look sizes up. Aligning the header
+// like `max_align_t` keeps the user's pointer suitably aligned.
+struct alloc_header
+{
+    // Where the block was allocated, if we're tracking that.
+    _Alignas(max_align_t) struct alloc_site* site;
 
-#define DO_MALLOC(SIZE) \
-    (alloc_limit_may_alloc(SIZE) \
-     ? alloc_limit_did_alloc(malloc(SIZE), SIZE) \
-     : NULL)
+    size_t size;
 
-#define DO_FREE(PTR) \
-     (alloc_limit_will_free(PTR), free(PTR))
+    // The `limit_epoch` the block was charged against, or 0 if it
+    // wasn't charged against any limit.
+    uint32_t epoch;
 
-#define DO_REALLOC(PTR, NEW_SIZE) \
-    (!PTR \
-     ? DO_MALLOC(NEW_SIZE) \
-     : alloc_limit_state == NO_LIMIT \
-     ? realloc(PTR, NEW_SIZE) \
-     : alloc_limit_state == LIMIT_TOTAL \
-     ? realloc_with_total_limit(PTR, NEW_SIZE) \
-     : alloc_limit_state == LIMIT_PEAK \
-     ? realloc_with_peak_limit(PTR, NEW_SIZE) \
-     : NULL)
+    // Distinguishes our blocks from pointers that some other allocator
+    // (e.g. strdup(3)) handed the user, which we pass through as is.
+    // For those we can only count on the 16 bytes before the pointer
+    // being mapped (as the other allocator's own header), so this must
+    // stay within them.
+    uint32_t cookie;
 
+    // How far past the start of the underlying allocation the header
+    // is, which is 0 except for over-aligned blocks.
+    uint32_t offset;
+};
 
-/////
-///// PUBLIC API FUNCTIONS
-/////
+#define HEADER_SIZE   (sizeof(struct alloc_header))
 
+_Static_assert(HEADER_SIZE - offsetof(struct alloc_header, cookie) <= 16,
+               "cookie must be within 16 bytes of the user's pointer");
+#define HEADER_OF(P)  ((struct alloc_header*) (P) - 1)
+#define BASE_OF(P)    ((char*) HEADER_OF(P) - HEADER_OF(P)->offset)
 
-///
-/// TRACING WRAPPERS
-///
+static uint32_t cookie_for(void const* p)
+{
+    return (uint32_t) ((uintptr_t) p >> 4) ^ UINT32_C(0x211a110c);
+}
 
-void* rt211_calloc(size_t nmemb, size_t size)
+// For a foreign pointer this reads the other allocator's bookkeeping,
+// which is harmless but would upset ASan.
+__attribute__((no_sanitize_address))
+static bool is_our_block(void const* p)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("calloc(%zu, %zu)", nmemb, size);
+    return HEADER_OF(p)->cookie == cookie_for(p);
+}
 
-    return DO_CALLOC(nmemb, size);
+// A block we've freed whose memory is still held by the guard allocator
+// (see alloc_guard.h), which will report freeing it again.
+__attribute__((no_sanitize_address))
+static bool is_freed_guarded(void const* p)
+{
+    return guard_blocks && HEADER_OF(p)->cookie == ~cookie_for(p) &&
+           is_guarded(BASE_OF(p));
 }
 
-void* rt211_malloc(size_t size)
+// Tells the guard allocator, if it made block `base`, that the user's
+// part of it starts `prefix` bytes in, after our header.
+static void* set_guard_prefix(void* base, size_t prefix)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("malloc(%zu)", size);
+    if (is_guarded(base)) rt211_guard_set_prefix(base, prefix);
+    return base;
+}
 
-    return DO_MALLOC(size);
+static void* header_to_user(struct alloc_header* header, size_t n)
+{
+    if (!header) return NULL;
+
+    void* p = header + 1;
+    header->size   = n;
+    header->epoch  = 0;
+    header->cookie = cookie_for(p);
+    header->offset = 0;
+    header->site   = NULL;
+    return p;
 }
 
-void rt211_free(void *ptr)
+static void* block_malloc(size_t n)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("free(%p)", ptr);
+    if (n > SIZE_MAX - HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    DO_FREE(ptr);
+    return header_to_user(
+            set_guard_prefix(base_malloc(HEADER_SIZE + n), HEADER_SIZE), n);
 }
 
-void* rt211_realloc(void *ptr, size_t size)
+// Caller is responsible for checking that `nmemb * size` doesn't
+// overflow.
+static void* block_calloc(size_t nmemb, size_t size)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("realloc(%p, %zu)", ptr, size);
+    size_t n = nmemb * size;
+
+    if (n > SIZE_MAX - HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    return DO_REALLOC(ptr, size);
+    return header_to_user(
+            set_guard_prefix(base_calloc(1, HEADER_SIZE + n), HEADER_SIZE), n);
 }
 
-void* rt211_reallocf(void *ptr, size_t size)
+// Puts the header just before the first suitably aligned address that
+// leaves room for it.
+static void* block_aligned(size_t align, size_t n)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("reallocf(%p, %zu)", ptr, size);
+    if (align <= _Alignof(max_align_t)) return block_malloc(n);
 
-    void* result = DO_REALLOC(ptr, size);
-    if (!result) DO_FREE(ptr);
-    return result;
+    size_t offset = (HEADER_SIZE + align - 1) & ~(align - 1);
+
+    if (offset - HEADER_SIZE > UINT32_MAX || n > SIZE_MAX - offset) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* base;
+    int   error = base_memalign(&base, align, offset + n);
+    if (error) {
+        errno = error;
+        return NULL;
+    }
+
+    set_guard_prefix(base, offset);
+    void* p = header_to_user((struct alloc_header*) ((char*) base + offset) - 1, n);
+    HEADER_OF(p)->offset = (uint32_t) (offset - HEADER_SIZE);
+    return p;
 }
 
+static void block_free(void* p);
 
-///
-/// SIMULATING ALLOCATION FAILURE
-///
+static void* block_realloc(void* p, size_t n)
+{
+    // realloc(3) can't keep a foreign or over-aligned block where it is.
+    if (!is_our_block(p) || HEADER_OF(p)->offset) {
+        void* q = block_malloc(n);
+        if (q) {
+            size_t old_n = is_our_block(p) ? HEADER_OF(p)->size
+                                           : base_usable_size(p);
+            memcpy(q, p, old_n < n ? old_n : n);
+            block_free(p);
+        }
+        return q;
+    }
 
-void alloc_limit_set_no_limit(void)
+    if (n > SIZE_MAX - HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return header_to_user(
+            set_guard_prefix(base_realloc(HEADER_OF(p), HEADER_SIZE + n),
+                             HEADER_SIZE),
+            n);
+}
+
+static void block_free(void* p)
 {
-    alloc_limit_state = NO_LIMIT;
-    forget_everything();
-    bytes_remaining = 0;
+    if (!p) {
+        return;
+    } else if (is_our_block(p)) {
+        void* base = BASE_OF(p);
+        HEADER_OF(p)->cookie = ~cookie_for(p);
+        base_free(base);
+    } else if (is_freed_guarded(p)) {
+        base_free(BASE_OF(p));
+    } else {
+        base_free(p);
+    }
 }
 
-void alloc_limit_set_total(size_t n)
+static bool
+lookup_and_forget(void* p, struct alloc_record* out)
 {
-    alloc_limit_state = LIMIT_TOTAL;
-    forget_everything();
-    bytes_remaining = n;
+    if (!is_our_block(p)) return false;
+
+    struct alloc_header* header = HEADER_OF(p);
+    *out = (struct alloc_record) {
+        .pointer = p,
+        .size    = header->size,
+        .epoch   = header->epoch,
+        .site    = header->site,
+    };
+
+    header->epoch = 0;
+    header->site  = NULL;
+
+    // Only the table knows the generation.
+    struct alloc_record rec;
+    if ((track_leaks || track_snapshots) && table_forget(p, &rec))
+        out->generation = rec.generation;
+
+    return true;
 }
 
-void alloc_limit_set_peak(size_t n)
+// The size of block `p` for alloc_stats_get(3), or 0 if it isn't ours.
+static size_t block_size(void* p)
 {
-    alloc_limit_state = LIMIT_PEAK;
-    forget_everything();
-    bytes_remaining = n;
+    return is_our_block(p) ? HEADER_OF(p)->size : 0;
+}
+
+// How many bytes of block `p` the user could actually use.
+static size_t block_usable_size(void* p)
+{
+    return base_usable_size(BASE_OF(p)) - HEADER_SIZE - HEADER_OF(p)->offset;
+}
+
+static void remember_allocation(struct alloc_record const* rec)
+{
+    struct alloc_header* header = HEADER_OF(rec->pointer);
+    header->size  = rec->size;
+    header->epoch = rec->epoch;
+    header->site  = rec->site;
+
+    if (track_leaks || track_snapshots) table_remember(rec);
+}
+
+// The header has everything, so the table is only for what needs to
+// walk every block.
+#define EVERY_BLOCK_IN_TABLE  false
+
+#else // !defined(LIB211_ALLOC_HEADER)
+
+#define block_malloc   base_malloc
+#define block_calloc   base_calloc
+#define block_realloc  base_realloc
+#define block_free     base_free
+
+static void* block_aligned(size_t align, size_t n)
+{
+    if (align < sizeof(void*)) align = sizeof(void*);
+
+    void* p;
+    int   error = base_memalign(&p, align, n);
+    if (error) {
+        errno = error;
+        return NULL;
+    }
+
+    return p;
+}
+
+// The size of block `p` for alloc_stats_get(3), or 0 if it isn't ours.
+static size_t block_size(void* p)
+{
+    struct table_shard* shard = shard_of(p);
+
+    pthread_mutex_lock(&shard->lock);
+    struct alloc_record* rec  = alloc_table_find(&shard->table, p);
+    size_t               size = rec ? rec->size : 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    return size;
+}
+
+#define block_usable_size  base_usable_size
+
+static bool
+lookup_and_forget(void* p, struct alloc_record* out)
+{
+    return table_forget(p, out);
+}
+
+static void remember_allocation(struct alloc_record const* rec)
+{
+    table_remember(rec);
+}
+
+// Only the table knows requested sizes, which alloc_stats_get(3) counts
+// in both modes, so every block goes in it, whatever the limit.
+#define EVERY_BLOCK_IN_TABLE  true
+
+#endif // LIB211_ALLOC_HEADER
+
+// Do we need to remember blocks of this state?
+static bool is_tracking(enum limit_state state)
+{
+    return EVERY_BLOCK_IN_TABLE || state == LIMIT_PEAK || peak_frames ||
+           track_sites || track_snapshots;
+}
+
+// The epoch to record for a block that replaces `old` (if any), which
+// decides which peak limits give its bytes back when it goes away. A
+// pushed limit that only paid for `old`'s growth (see `frame_cost`)
+// mustn't, so a resized block keeps its old epoch, unless it was from
+// before the current limit, which then charged it in full.
+static uint32_t charge_epoch(struct alloc_record const* old)
+{
+    if (!any_limit(alloc_limit_state)) return 0;
+    if (!old) return scope_epoch;
+    return old->epoch > limit_epoch ? old->epoch : limit_epoch;
+}
+
+static void remember_new_block(void* p, size_t n, struct alloc_site* site,
+                               struct alloc_record const* old)
+{
+    struct alloc_record rec = {
+        .pointer    = p,
+        .size       = n,
+        .epoch      = charge_epoch(old),
+        .generation = atomic_load_explicit(&snapshot_generation,
+                                           memory_order_relaxed),
+        .site       = site,
+    };
+
+    remember_allocation(&rec);
+    rt211_site_live(site, n);
+    if (track_timeline) rt211_timeline_alloc(n, block_usable_size(p));
+}
+
+static void forget_allocation(void* p)
+{
+    struct alloc_record rec;
+
+    if (track_growth) rt211_growth_free(p);
+
+    if (lookup_and_forget(p, &rec)) {
+        limit_settle(&rec, 0);
+        rt211_site_dead(rec.site, rec.size);
+        if (track_timeline) rt211_timeline_free(rec.size, block_usable_size(p));
+    }
+}
+
+// Charges `n` bytes against the limit, if any, in anticipation of
+// allocating them. Returns false if the limit doesn't allow it.
+static bool alloc_limit_may_alloc(size_t n)
+{
+    return !any_limit(alloc_limit_state) || limit_charge(NULL, n);
+}
+
+// Finishes an allocation of `n` bytes that `alloc_limit_may_alloc`
+// allowed, giving back the charge if it failed.
+static void* alloc_limit_did_alloc(void* p, size_t n, struct alloc_site* site)
+{
+    enum limit_state state = alloc_limit_state;
+
+    if (!p) {
+        if (any_limit(state)) limit_uncharge(NULL, n);
+        return NULL;
+    }
+
+    if (is_tracking(state))
+        remember_new_block(p, n, site, NULL);
+
+    return p;
+}
+
+static void alloc_limit_will_free(void* p)
+{
+    if (!p) return;
+
+    if (is_tracking(alloc_limit_state))
+        forget_allocation(p);
+}
+
+
+///
+/// WRAPPERS FOR MALLOC/FREE API
+///
+
+static inline void*
+realloc_with_total_limit(void *ptr, size_t new_size)
+{
+    if (alloc_limit_may_alloc(new_size))
+        return alloc_limit_did_alloc(block_realloc(ptr, new_size), new_size,
+                                     NULL);
+    else
+        return NULL;
+}
+
+static inline void*
+realloc_tracked(void *ptr, size_t new_size, struct alloc_site* site)
+{
+    bool limited = any_limit(alloc_limit_state);
+
+    // The block may move, so we take its record out now and put it back
+    // under whichever pointer we end up with.
+    struct alloc_record  old;
+    struct alloc_record* known   = lookup_and_forget(ptr, &old) ? &old : NULL;
+    void*                new_ptr = NULL;
+
+    // The old block may be gone by the time the timeline counts it out.
+    size_t old_usable = known && track_timeline ? block_usable_size(ptr) : 0;
+
+    if (!limited || limit_charge(known, new_size)) {
+        new_ptr = block_realloc(ptr, new_size);
+        if (!new_ptr && limited) limit_uncharge(known, new_size);
+    }
+
+    if (!new_ptr) {
+        if (known) remember_allocation(&old);
+        return NULL;
+    }
+
+    if (known) {
+        limit_settle(&old, new_size);
+        rt211_site_dead(old.site, old.size);
+        if (track_timeline) rt211_timeline_free(old.size, old_usable);
+
+        if (track_growth)
+            rt211_growth_realloc(site, ptr, old.size, new_ptr, new_size);
+    }
+    remember_new_block(new_ptr, new_size, site, known);
+
+    return new_ptr;
+}
+
+static void* do_calloc(size_t nmemb, size_t size, struct alloc_site* site)
+{
+    if (nmemb && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (!alloc_limit_may_alloc(nmemb * size)) return NULL;
+
+    return alloc_limit_did_alloc(block_calloc(nmemb, size), nmemb * size,
+                                 site);
+}
+
+static void* do_malloc(size_t size, struct alloc_site* site)
+{
+    if (!alloc_limit_may_alloc(size)) return NULL;
+
+    return alloc_limit_did_alloc(block_malloc(size), size, site);
+}
+
+static void* do_aligned(size_t align, size_t size, struct alloc_site* site)
+{
+    if (!alloc_limit_may_alloc(size)) return NULL;
+
+    return alloc_limit_did_alloc(block_aligned(align, size), size, site);
+}
+
+static void do_free(void* ptr)
+{
+    alloc_limit_will_free(ptr);
+    block_free(ptr);
+}
+
+static void* do_realloc(void* ptr, size_t size, struct alloc_site* site)
+{
+    enum limit_state state = alloc_limit_state;
+
+    if (!ptr)
+        return do_malloc(size, site);
+    else if (is_tracking(state))
+        return realloc_tracked(ptr, size, site);
+    else if (any_limit(state))
+        return realloc_with_total_limit(ptr, size);
+    else
+        return block_realloc(ptr, size);
+}
+
+
+/////
+///// PUBLIC API FUNCTIONS
+/////
+
+
+///
+/// TRACING WRAPPERS
+///
+
+// Counts a successful request for `size` bytes that returned `p`.
+static void count_request(void* p, size_t size)
+{
+    rt211_stats_alloc(size);
+    if (track_sizes) rt211_histogram_add(size, block_usable_size(p));
+}
+
+// In exploration mode, forks, and returns true in the child, where the
+// allocation should fail.
+static bool explore_failure(struct alloc_site* site)
+{
+    if (!explore_allocs || !rt211_explore_fork(site)) return false;
+
+    errno = ENOMEM;
+    return true;
+}
+
+static bool bad_alignment(size_t alignment)
+{
+    if (alignment && !(alignment & (alignment - 1))) return false;
+
+    errno = EINVAL;
+    return true;
+}
+
+// With a limit or any instrumentation, allocation calls go through
+// these, which do everything.
+
+static void* full_calloc(size_t nmemb, size_t size,
+                         char const* file, int line, char const* func)
+{
+    struct alloc_site* site = rt211_site(file, line, func);
+    rt211_site_call(site, nmemb && size <= SIZE_MAX / nmemb
+                          ? nmemb * size : SIZE_MAX);
+    rt211_stats_call(STATS_CALLOC);
+
+    void* result = explore_failure(site) ? NULL
+                 : do_calloc(nmemb, size, site);
+    if (result) count_request(result, nmemb * size);
+    if (result && track_profile) rt211_profile_alloc(result, nmemb * size);
+    rt211_trace_op(TRACE_CALLOC, nmemb, size, NULL, result, site);
+    if (track_timeline) rt211_timeline_tick();
+    return result;
+}
+
+static void* full_malloc(size_t size,
+                         char const* file, int line, char const* func)
+{
+    struct alloc_site* site = rt211_site(file, line, func);
+    rt211_site_call(site, size);
+    rt211_stats_call(STATS_MALLOC);
+
+    void* result = explore_failure(site) ? NULL
+                 : do_malloc(size, site);
+    if (result) count_request(result, size);
+    if (result && track_profile) rt211_profile_alloc(result, size);
+    rt211_trace_op(TRACE_MALLOC, 1, size, NULL, result, site);
+    if (track_timeline) rt211_timeline_tick();
+    return result;
+}
+
+static void* full_aligned(size_t alignment, size_t size,
+                          char const* file, int line, char const* func)
+{
+    struct alloc_site* site = rt211_site(file, line, func);
+    rt211_site_call(site, size);
+    rt211_stats_call(STATS_MALLOC);
+
+    void* result = bad_alignment(alignment) || explore_failure(site) ? NULL
+                 : do_aligned(alignment, size, site);
+    if (result) count_request(result, size);
+    if (result && track_profile) rt211_profile_alloc(result, size);
+    rt211_trace_op(TRACE_MEMALIGN, alignment, size, NULL, result, site);
+    if (track_timeline) rt211_timeline_tick();
+    return result;
+}
+
+static void full_free(void *ptr,
+                      char const* file, int line, char const* func)
+{
+    if (ptr) {
+        rt211_stats_call(STATS_FREE);
+        rt211_stats_free(block_size(ptr));
+    }
+
+    if (track_profile) rt211_profile_free(ptr);
+
+    // Trace first, in case another thread gets `ptr` back right away.
+    rt211_trace_op(TRACE_FREE, 1, 0, ptr, NULL, rt211_site(file, line, func));
+    do_free(ptr);
+    if (track_timeline) rt211_timeline_tick();
+}
+
+static void* full_realloc(void *ptr, size_t size,
+                          char const* file, int line, char const* func)
+{
+    struct alloc_site* site = rt211_site(file, line, func);
+    rt211_site_call(site, size);
+    rt211_stats_call(STATS_REALLOC);
+
+    size_t old_size = ptr ? block_size(ptr) : 0;
+    void*  result   = explore_failure(site) ? NULL
+                    : do_realloc(ptr, size, site);
+
+    if (result) {
+        rt211_stats_free(old_size);
+        count_request(result, size);
+    }
+
+    if (result && track_profile) {
+        rt211_profile_free(ptr);
+        rt211_profile_alloc(result, size);
+    }
+
+    rt211_trace_op(TRACE_REALLOC, 1, size, ptr, result, site);
+    if (track_timeline) rt211_timeline_tick();
+    return result;
+}
+
+static void* full_reallocf(void *ptr, size_t size,
+                           char const* file, int line, char const* func)
+{
+    struct alloc_site* site = rt211_site(file, line, func);
+    rt211_site_call(site, size);
+    rt211_stats_call(STATS_REALLOC);
+
+    size_t old_size = ptr ? block_size(ptr) : 0;
+    void*  result   = explore_failure(site) ? NULL
+                    : do_realloc(ptr, size, site);
+
+    // Either way, the old block is gone.
+    if (ptr) rt211_stats_free(old_size);
+    if (result) count_request(result, size);
+
+    if (track_profile) {
+        rt211_profile_free(ptr);
+        if (result) rt211_profile_alloc(result, size);
+    }
+
+    rt211_trace_op(TRACE_REALLOCF, 1, size, ptr, result, site);
+    if (!result) do_free(ptr);
+    if (track_timeline) rt211_timeline_tick();
+    return result;
+}
+
+// With no limit and nothing but alloc_stats_get(3) to keep up, calls go
+// through these instead, which only count.
+
+static void* plain_calloc(size_t nmemb, size_t size,
+                          char const* file, int line, char const* func)
+{
+    rt211_stats_call(STATS_CALLOC);
+
+    if (nmemb && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* result = block_calloc(nmemb, size);
+    if (result) rt211_stats_alloc(block_size(result));
+    return result;
+}
+
+static void* plain_malloc(size_t size,
+                          char const* file, int line, char const* func)
+{
+    rt211_stats_call(STATS_MALLOC);
+
+    void* result = block_malloc(size);
+    if (result) rt211_stats_alloc(block_size(result));
+    return result;
+}
+
+static void* plain_aligned(size_t alignment, size_t size,
+                           char const* file, int line, char const* func)
+{
+    rt211_stats_call(STATS_MALLOC);
+
+    void* result = bad_alignment(alignment) ? NULL
+                 : block_aligned(alignment, size);
+    if (result) rt211_stats_alloc(block_size(result));
+    return result;
+}
+
+static void plain_free(void *ptr,
+                       char const* file, int line, char const* func)
+{
+    if (ptr) {
+        rt211_stats_call(STATS_FREE);
+        rt211_stats_free(block_size(ptr));
+    }
+
+    block_free(ptr);
+}
+
+static void* plain_realloc(void *ptr, size_t size,
+                           char const* file, int line, char const* func)
+{
+    rt211_stats_call(STATS_REALLOC);
+
+    size_t old_size = ptr ? block_size(ptr) : 0;
+    void*  result   = ptr ? block_realloc(ptr, size) : block_malloc(size);
+
+    if (result) {
+        rt211_stats_free(old_size);
+        rt211_stats_alloc(block_size(result));
+    }
+
+    return result;
+}
+
+static void* plain_reallocf(void *ptr, size_t size,
+                            char const* file, int line, char const* func)
+{
+    rt211_stats_call(STATS_REALLOC);
+
+    size_t old_size = ptr ? block_size(ptr) : 0;
+    void*  result   = ptr ? block_realloc(ptr, size) : block_malloc(size);
+
+    if (ptr) rt211_stats_free(old_size);
+    if (result) rt211_stats_alloc(block_size(result));
+    else block_free(ptr);
+
+    return result;
+}
+
+// Until the first allocation, calls go through these, which set the
+// limit from the environment and then try again. We wait that long so
+// a program (or test) may still setenv(3) the limit before it starts.
+
+static void init_limit(void)
+{
+    pthread_once(&alloc_limit_once, &alloc_limit_init_once);
+}
+
+static void* init_calloc(size_t nmemb, size_t size,
+                         char const* file, int line, char const* func)
+{
+    init_limit();
+    return rt211_calloc_at(nmemb, size, file, line, func);
+}
+
+static void* init_malloc(size_t size,
+                         char const* file, int line, char const* func)
+{
+    init_limit();
+    return rt211_malloc_at(size, file, line, func);
+}
+
+static void* init_aligned(size_t alignment, size_t size,
+                          char const* file, int line, char const* func)
+{
+    init_limit();
+    return rt211_aligned_alloc_at(alignment, size, file, line, func);
+}
+
+static void init_free(void *ptr,
+                      char const* file, int line, char const* func)
+{
+    init_limit();
+    rt211_free_at(ptr, file, line, func);
+}
+
+static void* init_realloc(void *ptr, size_t size,
+                          char const* file, int line, char const* func)
+{
+    init_limit();
+    return rt211_realloc_at(ptr, size, file, line, func);
+}
+
+static void* init_reallocf(void *ptr, size_t size,
+                           char const* file, int line, char const* func)
+{
+    init_limit();
+    return rt211_reallocf_at(ptr, size, file, line, func);
+}
+
+static struct alloc_ops const init_ops = {
+    init_malloc, init_calloc, init_aligned,
+    init_realloc, init_reallocf, init_free,
+};
+
+static struct alloc_ops const plain_ops = {
+    plain_malloc, plain_calloc, plain_aligned,
+    plain_realloc, plain_reallocf, plain_free,
+};
+
+static struct alloc_ops const full_ops = {
+    full_malloc, full_calloc, full_aligned,
+    full_realloc, full_reallocf, full_free,
+};
+
+static struct alloc_ops const* _Atomic alloc_ops = &init_ops;
+
+// Picks the allocation functions for the current configuration. Called
+// with `limit_lock` held whenever that changes.
+static void select_alloc_ops(void)
+{
+    bool plain = !EVERY_BLOCK_IN_TABLE &&
+                 alloc_limit_state == NO_LIMIT && !limit_depth &&
+                 !track_sites && !track_sizes && !explore_allocs &&
+                 !track_profile && !track_snapshots &&
+                 !rt211_trace_enabled();
+
+    atomic_store_explicit(&alloc_ops, plain ? &plain_ops : &full_ops,
+                          memory_order_release);
+}
+
+static struct alloc_ops const* current_ops(void)
+{
+    return atomic_load_explicit(&alloc_ops, memory_order_acquire);
+}
+
+// The `_at` versions take the call site, which lib211_alloc.h supplies.
+// The plain versions are for callers that don't know it, such as code
+// that calls through a function pointer.
+
+void* rt211_calloc_at(size_t nmemb, size_t size,
+                      char const* file, int line, char const* func)
+{
+    return current_ops()->calloc(nmemb, size, file, line, func);
+}
+
+void* rt211_malloc_at(size_t size,
+                      char const* file, int line, char const* func)
+{
+    return current_ops()->malloc(size, file, line, func);
+}
+
+void* rt211_aligned_alloc_at(size_t alignment, size_t size,
+                             char const* file, int line, char const* func)
+{
+    return current_ops()->aligned_alloc(alignment, size, file, line, func);
+}
+
+int rt211_posix_memalign_at(void** memptr, size_t alignment, size_t size,
+                            char const* file, int line, char const* func)
+{
+    if (alignment % sizeof(void*)) return EINVAL;
+
+    int   saved_errno = errno;
+    void* result      = rt211_aligned_alloc_at(alignment, size,
+                                               file, line, func);
+    int   error       = result ? 0 : errno;
+
+    errno = saved_errno;
+    if (result) *memptr = result;
+    return error;
+}
+
+void rt211_free_at(void *ptr,
+                   char const* file, int line, char const* func)
+{
+    current_ops()->free(ptr, file, line, func);
+}
+
+void* rt211_realloc_at(void *ptr, size_t size,
+                       char const* file, int line, char const* func)
+{
+    return current_ops()->realloc(ptr, size, file, line, func);
+}
+
+void* rt211_reallocf_at(void *ptr, size_t size,
+                        char const* file, int line, char const* func)
+{
+    return current_ops()->reallocf(ptr, size, file, line, func);
+}
+
+void* rt211_calloc(size_t nmemb, size_t size)
+{
+    return rt211_calloc_at(nmemb, size, NULL, 0, NULL);
+}
+
+void* rt211_malloc(size_t size)
+{
+    return rt211_malloc_at(size, NULL, 0, NULL);
+}
+
+void* rt211_aligned_alloc(size_t alignment, size_t size)
+{
+    return rt211_aligned_alloc_at(alignment, size, NULL, 0, NULL);
+}
+
+int rt211_posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    return rt211_posix_memalign_at(memptr, alignment, size, NULL, 0, NULL);
+}
+
+void rt211_free(void *ptr)
+{
+    rt211_free_at(ptr, NULL, 0, NULL);
+}
+
+void* rt211_realloc(void *ptr, size_t size)
+{
+    return rt211_realloc_at(ptr, size, NULL, 0, NULL);
+}
+
+void* rt211_reallocf(void *ptr, size_t size)
+{
+    return rt211_reallocf_at(ptr, size, NULL, 0, NULL);
+}
+
+// For the preload library's malloc_usable_size(3), which must see past
+// any header or guard.
+size_t rt211_malloc_usable_size(void *ptr)
+{
+    return ptr ? block_usable_size(ptr) : 0;
+}
+
+
+///
+/// SIMULATING ALLOCATION FAILURE
+///
+
+static void reset_limit(enum limit_state state, size_t n)
+{
+    rt211_alloc_init();
+    pthread_mutex_lock(&limit_lock);
+
+    alloc_limit_state = state;
+    limit_depth     = 0;
+    peak_frames     = 0;
+    bytes_remaining = n;
+    limit_epoch     = scope_epoch = ++last_epoch;
+    select_alloc_ops();
+
+    pthread_mutex_unlock(&limit_lock);
+}
+
+void alloc_limit_set_no_limit(void)
+{
+    reset_limit(NO_LIMIT, 0);
+}
+
+void alloc_limit_set_total(size_t n)
+{
+    reset_limit(LIMIT_TOTAL, n);
+}
+
+void alloc_limit_set_peak(size_t n)
+{
+    reset_limit(LIMIT_PEAK, n);
+}
+
+void alloc_limit_push(enum alloc_limit_kind kind, size_t n)
+{
+    // Reading the environment later would reset the limits.
+    init_limit();
+    rt211_alloc_init();
+    pthread_mutex_lock(&limit_lock);
+
+    size_t depth = limit_depth;
+    if (depth == MAX_LIMIT_DEPTH) {
+        fprintf(stderr, "lib211_alloc: alloc_limit_push: more than %d "
+                        "nested limits\n", MAX_LIMIT_DEPTH);
+        exit(255);
+    }
+
+    struct limit_frame* frame = &limit_frames[depth];
+    frame->kind      = kind == ALLOC_LIMIT_TOTAL ? LIMIT_TOTAL : LIMIT_PEAK;
+    frame->remaining = n;
+    frame->epoch     = ++last_epoch;
+
+    if (frame->kind == LIMIT_PEAK) ++peak_frames;
+    limit_depth = depth + 1;
+    scope_epoch = frame->epoch;
+    select_alloc_ops();
+
+    pthread_mutex_unlock(&limit_lock);
+}
+
+void alloc_limit_pop(void)
+{
+    pthread_mutex_lock(&limit_lock);
+
+    size_t depth = limit_depth;
+    if (depth == 0) {
+        fprintf(stderr, "lib211_alloc: alloc_limit_pop: no limit to pop\n");
+        exit(255);
+    }
+
+    --depth;
+    if (limit_frames[depth].kind == LIMIT_PEAK) --peak_frames;
+    limit_depth = depth;
+    scope_epoch = depth ? limit_frames[depth - 1].epoch : limit_epoch;
+    select_alloc_ops();
+
+    pthread_mutex_unlock(&limit_lock);
 }
@@ -0,0 +1,226 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_explore.h"
+#include "alloc_growth.h"
+#include "alloc_leaks.h"
+#include "alloc_sites.h"
+#include "alloc_timeline.h"
+#include "alloc_trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Sites live in a fixed-size open-addressing table that only grows by
+// filling in empty slots with a compare-and-swap, so finding a site
+// never takes a lock. If it fills up, further sites share `overflow`.
+#define SITE_SLOTS  ((size_t) 1 << 13)
+
+static struct alloc_site* _Atomic site_table[SITE_SLOTS];
+static struct alloc_site  unknown_site  = { .file = NULL, .func = "unknown" };
+static struct alloc_site  overflow_site = { .file = NULL, .func = "other sites" };
+
+static _Atomic uint32_t next_site_id = 1;
+
+static pthread_once_t sites_once       = PTHREAD_ONCE_INIT;
+static pthread_once_t sites_start_once = PTHREAD_ONCE_INIT;
+static _Atomic bool   sites_enabled    = false;
+static FILE*          sites_out        = NULL;
+static pid_t          owner;        // only this process writes at exit
+
+static void dump_sites(void);
+
+static void
+sites_init(void)
+{
+    sites_out     = rt211_env_output("RT211_ALLOC_SITES");
+    sites_enabled = sites_out || rt211_trace_enabled() ||
+                    rt211_leaks_enabled() || rt211_explore_enabled() ||
+                    rt211_growth_enabled() || rt211_timeline_enabled();
+
+    if (sites_enabled) {
+        unknown_site.id  = next_site_id++;
+        overflow_site.id = next_site_id++;
+    }
+
+    if (sites_out) {
+        owner = getpid();
+        atexit(&dump_sites);
+    }
+}
+
+bool rt211_sites_enabled(void)
+{
+    pthread_once(&sites_once, &sites_init);
+    return sites_enabled;
+}
+
+static void
+sites_start(void)
+{
+    if (sites_enabled) return;
+
+    unknown_site.id  = next_site_id++;
+    overflow_site.id = next_site_id++;
+    sites_enabled    = true;
+}
+
+void rt211_sites_start(void)
+{
+    pthread_once(&sites_once, &sites_init);
+    pthread_once(&sites_start_once, &sites_start);
+}
+
+static size_t
+hash_site(char const* file, int line, char const* func)
+{
+    uint64_t h = (uint64_t) (uintptr_t) file;
+    h = (h ^ (uint64_t) line)              * UINT64_C(0x9e3779b97f4a7c15);
+    h = (h ^ (uint64_t) (uintptr_t) func)  * UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t) (h >> 32);
+}
+
+static bool
+site_is(struct alloc_site const* site,
+        char const* file, int line, char const* func)
+{
+    return site->file == file && site->line == line && site->func == func;
+}
+
+struct alloc_site* rt211_site(char const* file, int line, char const* func)
+{
+    if (!rt211_sites_enabled()) return NULL;
+    if (!file) return &unknown_site;
+
+    struct alloc_site* fresh = NULL;
+    size_t mask = SITE_SLOTS - 1;
+    size_t i    = hash_site(file, line, func) & mask;
+
+    for (size_t probes = 0; probes < SITE_SLOTS; ++probes, i = (i + 1) & mask) {
+        struct alloc_site* site = site_table[i];
+
+        if (!site) {
+            if (!fresh) {
+                fresh = calloc(1, sizeof *fresh);
+                if (!fresh) return &overflow_site;
+                fresh->file = file;
+                fresh->line = line;
+                fresh->func = func;
+                fresh->id   = next_site_id++;
+            }
+
+            if (atomic_compare_exchange_strong(&site_table[i], &site, fresh))
+                return fresh;
+
+            // Somebody else just took the slot, so `site` now holds
+            // their record, which might be for our site.
+        }
+
+        if (site_is(site, file, line, func)) {
+            free(fresh);
+            return site;
+        }
+    }
+
+    free(fresh);
+    return &overflow_site;
+}
+
+void rt211_site_call(struct alloc_site* site, size_t n)
+{
+    if (!site) return;
+
+    atomic_fetch_add_explicit(&site->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->bytes, n, memory_order_relaxed);
+}
+
+void rt211_site_live(struct alloc_site* site, size_t n)
+{
+    if (!site) return;
+
+    size_t live = n + atomic_fetch_add_explicit(&site->live_bytes, n,
+                                                memory_order_relaxed);
+    size_t peak = atomic_load_explicit(&site->peak_live_bytes,
+                                       memory_order_relaxed);
+
+    while (live > peak &&
+           !atomic_compare_exchange_weak(&site->peak_live_bytes, &peak, live))
+    { }
+}
+
+void rt211_site_dead(struct alloc_site* site, size_t n)
+{
+    if (!site) return;
+
+    atomic_fetch_sub_explicit(&site->live_bytes, n, memory_order_relaxed);
+}
+
+void rt211_sites_for_each(void (*fn)(struct alloc_site*, void* aux),
+                          void* aux)
+{
+    for (size_t i = 0; i < SITE_SLOTS; ++i) {
+        struct alloc_site* site = site_table[i];
+        if (site) fn(site, aux);
+    }
+
+    fn(&unknown_site, aux);
+    fn(&overflow_site, aux);
+}
+
+char const* rt211_site_name(struct alloc_site const* site,
+                            char* buf, size_t size)
+{
+    if (site->file)
+        snprintf(buf, size, "%s:%d (%s)", site->file, site->line, site->func);
+    else
+        snprintf(buf, size, "(%s)", site->func);
+
+    return buf;
+}
+
+static int
+compare_by_bytes(void const* a, void const* b)
+{
+    size_t x = (*(struct alloc_site* const*) a)->bytes,
+           y = (*(struct alloc_site* const*) b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void
+dump_sites(void)
+{
+    if (getpid() != owner) return;
+
+    struct alloc_site** sites = malloc((SITE_SLOTS + 2) * sizeof *sites);
+    if (!sites) return;
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < SITE_SLOTS; ++i)
+        if (site_table[i] && site_table[i]->calls)
+            sites[count++] = site_table[i];
+
+    if (unknown_site.calls)  sites[count++] = &unknown_site;
+    if (overflow_site.calls) sites[count++] = &overflow_site;
+
+    qsort(sites, count, sizeof *sites, &compare_by_bytes);
+
+    fprintf(sites_out, "%12s %14s %14s %14s  %s\n",
+            "calls", "bytes", "live bytes", "peak live", "site");
+
+    for (size_t i = 0; i < count; ++i) {
+        char name[256];
+        fprintf(sites_out, "%12zu %14zu %14zu %14zu  %s\n",
+                (size_t) sites[i]->calls,
+                (size_t) sites[i]->bytes,
+                (size_t) sites[i]->live_bytes,
+                (size_t) sites[i]->peak_live_bytes,
+                rt211_site_name(sites[i], name, sizeof name));
+    }
+
+    free(sites);
+    rt211_env_close(sites_out);
+    sites_out = NULL;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// Per-call-site allocation statistics. The instrumented allocation
+// macros in lib211_alloc.h pass along where they were used, and we keep
+// counters for each distinct site. Setting RT211_ALLOC_SITES (to a file
+// name or `&fd`) dumps them at exit as a table sorted by bytes.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct alloc_site
+{
+    char const* file;           // NULL if unknown
+    char const* func;
+    int         line;
+    uint32_t    id;             // sequential, starting from 1
+
+    _Atomic size_t calls;
+    _Atomic size_t bytes;
+    _Atomic size_t live_bytes;
+    _Atomic size_t peak_live_bytes;
+
+    // How reallocs here grow their blocks (see alloc_growth.h).
+    _Atomic size_t reallocs;
+    _Atomic size_t moves;
+    _Atomic size_t bytes_copied;
+    _Atomic size_t linear_blocks;       // grown by a fixed step
+    _Atomic size_t regrows;             // grown right after shrinking
+    _Atomic size_t overcopied_blocks;   // copied many times their size
+};
+
+// Does anything want call-site information?
+bool rt211_sites_enabled(void);
+
+// Starts recording call sites from now on, if we weren't already, for
+// features turned on while the program runs (see alloc_snapshot.h).
+void rt211_sites_start(void);
+
+// Returns the record for the given call site, creating it if need be,
+// or NULL if call sites aren't enabled. Passing a NULL `file` gets the
+// record for calls whose site is unknown.
+struct alloc_site* rt211_site(char const* file, int line, char const* func);
+
+// Counts a call at `site` allocating `n` bytes. (Does nothing if `site`
+// is NULL, as do the rest of these.)
+void rt211_site_call(struct alloc_site* site, size_t n);
+
+// Adjusts the live bytes of `site` for a block of `n` bytes that came
+// into or went out of existence.
+void rt211_site_live(struct alloc_site* site, size_t n);
+void rt211_site_dead(struct alloc_site* site, size_t n);
+
+// Calls `fn` on every site seen so far, including those for unknown
+// and overflow sites, in no particular order.
+void rt211_sites_for_each(void (*fn)(struct alloc_site*, void* aux),
+                          void* aux);
+
+// Formats `site` as "file:line (func)" into `buf`.
+char const* rt211_site_name(struct alloc_site const* site,
+                            char* buf, size_t size);
@@ -0,0 +1,93 @@
+#define _XOPEN_SOURCE 700
+
+#include "211_alloc_stats.h"
+#include "alloc_leaks.h"
+#include "alloc_snapshot.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct alloc_snapshot
+{
+    uint32_t           generation;  // of blocks allocated after it
+    uint64_t           time_ns;
+    struct alloc_stats stats;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void
+take(struct alloc_snapshot* snapshot, uint32_t generation)
+{
+    snapshot->generation = generation;
+    snapshot->time_ns    = now_ns();
+    alloc_stats_get(&snapshot->stats);
+}
+
+alloc_snapshot_t* alloc_snapshot_take(void)
+{
+    struct alloc_snapshot* snapshot = malloc(sizeof *snapshot);
+    if (snapshot) take(snapshot, rt211_snapshot_start());
+    return snapshot;
+}
+
+void alloc_snapshot_free(alloc_snapshot_t* snapshot)
+{
+    free(snapshot);
+}
+
+static size_t
+allocation_calls(struct alloc_stats const* stats)
+{
+    return stats->malloc_calls + stats->calloc_calls + stats->realloc_calls;
+}
+
+bool alloc_snapshot_diff(alloc_snapshot_t const* a,
+                         alloc_snapshot_t const* b,
+                         FILE* out)
+{
+    struct alloc_snapshot now;
+
+    if (!b) {
+        take(&now, UINT32_MAX);
+        b = &now;
+    } else if (a->generation > b->generation) {
+        alloc_snapshot_t const* t = a;
+        a = b;
+        b = t;
+    }
+
+    size_t count;
+    struct alloc_record* recs = rt211_live_blocks(a->generation,
+                                                  b->generation, &count);
+    if (!recs) return false;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+        total += recs[i].size;
+
+    fprintf(out,
+            "lib211_alloc: over %.3f s, %zu allocations of %zu bytes and "
+            "%zu frees took the heap from %zu to %zu bytes\n",
+            (b->time_ns - a->time_ns) / 1e9,
+            allocation_calls(&b->stats) - allocation_calls(&a->stats),
+            b->stats.total_bytes - a->stats.total_bytes,
+            b->stats.free_calls - a->stats.free_calls,
+            a->stats.current_bytes,
+            b->stats.current_bytes);
+    fprintf(out,
+            "lib211_alloc: %zu bytes in %zu blocks from then are still live\n",
+            total, count);
+
+    bool ok = rt211_blocks_print(out, recs, count);
+    free(recs);
+    return ok;
+}
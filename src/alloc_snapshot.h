@@ -0,0 +1,23 @@
+#pragma once
+
+// Heap snapshots (see alloc_snapshot_take(3)). A snapshot is just a
+// generation number plus the statistics at the time: once the first is
+// taken, every block goes into the live-allocation table stamped with
+// the current generation, and each snapshot starts a new one. Diffing
+// two snapshots then means picking out the live blocks whose generation
+// falls between theirs.
+
+#include "alloc_table.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Starts keeping every block, if we weren't already, and starts a new
+// generation, which it returns.
+uint32_t rt211_snapshot_start(void);
+
+// Copies the records of the live blocks from generations [`from`, `to`)
+// into a new array, storing their number in `*count`. Returns NULL if
+// there isn't memory for it.
+struct alloc_record*
+rt211_live_blocks(uint32_t from, uint32_t to, size_t* count);
@@ -0,0 +1,50 @@
+#include "211_alloc_stats.h"
+#include "alloc_stats.h"
+
+struct rt211_alloc_counters rt211_alloc_counters;
+
+void rt211_stats_call(enum stats_call which)
+{
+    rt211_count_call((enum rt211_count_call) which);
+}
+
+void rt211_stats_alloc(size_t n)
+{
+    rt211_count_alloc(n);
+}
+
+void rt211_stats_free(size_t n)
+{
+    rt211_count_free(n);
+}
+
+size_t rt211_stats_peak_restart(void)
+{
+    struct rt211_alloc_counters* c = &rt211_alloc_counters;
+    return atomic_exchange(&c->peak_bytes, c->current_bytes);
+}
+
+void rt211_stats_peak_resume(size_t old_peak)
+{
+    struct rt211_alloc_counters* c = &rt211_alloc_counters;
+    size_t peak = c->peak_bytes;
+
+    while (old_peak > peak &&
+           !atomic_compare_exchange_weak(&c->peak_bytes, &peak, old_peak))
+    { }
+}
+
+void alloc_stats_get(struct alloc_stats* out)
+{
+    struct rt211_alloc_counters* c = &rt211_alloc_counters;
+
+    *out = (struct alloc_stats) {
+        .current_bytes = c->current_bytes,
+        .peak_bytes    = c->peak_bytes,
+        .total_bytes   = c->total_bytes,
+        .malloc_calls  = c->calls[RT211_COUNT_MALLOC],
+        .calloc_calls  = c->calls[RT211_COUNT_CALLOC],
+        .realloc_calls = c->calls[RT211_COUNT_REALLOC],
+        .free_calls    = c->calls[RT211_COUNT_FREE],
+    };
+}
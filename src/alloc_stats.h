@@ -0,0 +1,29 @@
+#pragma once
+
+// Counters behind alloc_stats_get(3). These are kept in every limit
+// state, so each is only a relaxed atomic update or two.
+
+#include "211_alloc_stats.h"
+
+#include <stddef.h>
+
+enum stats_call
+{
+    STATS_MALLOC  = RT211_COUNT_MALLOC,
+    STATS_CALLOC  = RT211_COUNT_CALLOC,
+    STATS_REALLOC = RT211_COUNT_REALLOC,
+    STATS_FREE    = RT211_COUNT_FREE,
+};
+
+// Counts a call to the given function.
+void rt211_stats_call(enum stats_call);
+
+// Counts a block of `n` bytes coming into or going out of existence.
+void rt211_stats_alloc(size_t n);
+void rt211_stats_free(size_t n);
+
+// Starts `peak_bytes` over from `current_bytes`, so that it measures the
+// peak from here on, and returns the old peak. Pass that to
+// `rt211_stats_peak_resume` to fold it back in.
+size_t rt211_stats_peak_restart(void);
+void   rt211_stats_peak_resume(size_t old_peak);
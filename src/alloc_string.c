@@ -0,0 +1,123 @@
+// Accounted versions of the POSIX functions that allocate on the
+// caller's behalf. They get their memory from the instrumented
+// allocator, so it counts against limits and shows up in traces as
+// coming from the caller's site.
+
+#define _XOPEN_SOURCE 700
+#define LIB211_RAW_ALLOC
+#define LIB211_ALLOC_POSIX
+
+#include "lib211_alloc.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// How big a buffer getdelim(3) starts with.
+#define LINE_INITIAL_SIZE  120
+
+char* rt211_strdup_at(char const* s,
+                      char const* file, int line, char const* func)
+{
+    size_t size   = strlen(s) + 1;
+    char*  result = rt211_malloc_at(size, file, line, func);
+
+    if (result) memcpy(result, s, size);
+    return result;
+}
+
+char* rt211_strndup_at(char const* s, size_t n,
+                       char const* file, int line, char const* func)
+{
+    size_t len    = strnlen(s, n);
+    char*  result = rt211_malloc_at(len + 1, file, line, func);
+
+    if (result) {
+        memcpy(result, s, len);
+        result[len] = 0;
+    }
+
+    return result;
+}
+
+// Makes sure `*lineptr` has room for `need` bytes.
+static bool
+reserve_line(char** lineptr, size_t* n, size_t need,
+             char const* file, int line, char const* func)
+{
+    if (*lineptr && *n >= need) return true;
+
+    size_t size = *n < LINE_INITIAL_SIZE ? LINE_INITIAL_SIZE : *n;
+    while (size < need) {
+        if (size > SIZE_MAX / 2) {
+            errno = EOVERFLOW;
+            return false;
+        }
+        size *= 2;
+    }
+
+    char* buf = rt211_realloc_at(*lineptr, size, file, line, func);
+    if (!buf) return false;
+
+    *lineptr = buf;
+    *n       = size;
+    return true;
+}
+
+ssize_t rt211_getdelim_at(char** lineptr, size_t* n, int delim, FILE* stream,
+                          char const* file, int line, char const* func)
+{
+    if (!lineptr || !n || !stream) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t len = 0;
+    int    c;
+
+    flockfile(stream);
+
+    while ((c = getc_unlocked(stream)) != EOF) {
+        if (!reserve_line(lineptr, n, len + 2, file, line, func)) {
+            funlockfile(stream);
+            return -1;
+        }
+
+        (*lineptr)[len++] = (char) c;
+        if (c == delim) break;
+    }
+
+    funlockfile(stream);
+
+    if (!len) return -1;
+
+    (*lineptr)[len] = 0;
+    return (ssize_t) len;
+}
+
+ssize_t rt211_getline_at(char** lineptr, size_t* n, FILE* stream,
+                         char const* file, int line, char const* func)
+{
+    return rt211_getdelim_at(lineptr, n, '\n', stream, file, line, func);
+}
+
+char* rt211_strdup(char const* s)
+{
+    return rt211_strdup_at(s, NULL, 0, NULL);
+}
+
+char* rt211_strndup(char const* s, size_t n)
+{
+    return rt211_strndup_at(s, n, NULL, 0, NULL);
+}
+
+ssize_t rt211_getdelim(char** lineptr, size_t* n, int delim, FILE* stream)
+{
+    return rt211_getdelim_at(lineptr, n, delim, stream, NULL, 0, NULL);
+}
+
+ssize_t rt211_getline(char** lineptr, size_t* n, FILE* stream)
+{
+    return rt211_getdelim_at(lineptr, n, '\n', stream, NULL, 0, NULL);
+}
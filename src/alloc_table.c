@@ -0,0 +1,216 @@
+#include "alloc_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MIN_CAPACITY   64
+
+// How many old slots to migrate on each insertion or removal. Anything
+// at least 2 guarantees that the old array is drained before the new
+// one fills up enough to need growing again.
+#define MIGRATE_STEP   8
+
+// Marks an old slot whose entry was removed or migrated during
+// migration.
+static char tombstone_marker;
+#define TOMBSTONE      ((void*) &tombstone_marker)
+
+static size_t
+hash_pointer(void const* p, size_t mask)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    return (size_t) h & mask;
+}
+
+static struct alloc_record*
+probe(struct alloc_record* slots, size_t capacity, void const* p)
+{
+    if (!slots) return NULL;
+
+    size_t mask = capacity - 1;
+
+    for (size_t i = hash_pointer(p, mask); slots[i].pointer; i = (i + 1) & mask)
+        if (slots[i].pointer == p)
+            return &slots[i];
+
+    return NULL;
+}
+
+// Puts a record into `self->slots`, which must have a free slot and
+// must not contain `rec->pointer` already.
+static void
+place(struct alloc_table* self, struct alloc_record rec)
+{
+    size_t mask = self->capacity - 1;
+    size_t i    = hash_pointer(rec.pointer, mask);
+
+    while (self->slots[i].pointer) i = (i + 1) & mask;
+
+    self->slots[i] = rec;
+    ++self->count;
+}
+
+// Removes slot `i` from the current array by shifting later members of
+// its probe run backward, so that we never need tombstones here.
+static void
+delete_at(struct alloc_table* self, size_t i)
+{
+    size_t mask = self->capacity - 1;
+    size_t j    = i;
+
+    for (;;) {
+        j = (j + 1) & mask;
+        void* q = self->slots[j].pointer;
+        if (!q) break;
+
+        // Slot `j` may move back into the hole at `i` only if its home
+        // slot isn't cyclically in (i, j].
+        size_t home = hash_pointer(q, mask);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        self->slots[i] = self->slots[j];
+        i = j;
+    }
+
+    self->slots[i].pointer = NULL;
+    --self->count;
+}
+
+static void
+finish_migration(struct alloc_table* self)
+{
+    free(self->old_slots);
+    self->old_slots    = NULL;
+    self->old_capacity = 0;
+    self->old_count    = 0;
+    self->migrated     = 0;
+}
+
+static void
+migrate_some(struct alloc_table* self, size_t steps)
+{
+    if (!self->old_slots) return;
+
+    while (steps-- && self->migrated < self->old_capacity) {
+        struct alloc_record* rec = &self->old_slots[self->migrated++];
+
+        if (rec->pointer && rec->pointer != TOMBSTONE) {
+            place(self, *rec);
+            --self->old_count;
+
+            // Leave a tombstone, so that a lookup can't find the stale
+            // copy (and count its removal twice) once `pointer` is
+            // reused, but probe runs through here stay unbroken.
+            rec->pointer = TOMBSTONE;
+        }
+    }
+
+    if (self->migrated == self->old_capacity || !self->old_count)
+        finish_migration(self);
+}
+
+static bool
+grow(struct alloc_table* self)
+{
+    // Can't start a new migration until the previous one is done.
+    migrate_some(self, SIZE_MAX);
+
+    size_t new_capacity = self->capacity ? 2 * self->capacity : MIN_CAPACITY;
+    struct alloc_record* new_slots = calloc(new_capacity, sizeof *new_slots);
+    if (!new_slots) return false;
+
+    self->old_slots    = self->slots;
+    self->old_capacity = self->capacity;
+    self->old_count    = self->count;
+    self->migrated     = 0;
+
+    self->slots        = new_slots;
+    self->capacity     = new_capacity;
+    self->count        = 0;
+
+    if (!self->old_count) finish_migration(self);
+
+    return true;
+}
+
+struct alloc_record*
+alloc_table_find(struct alloc_table* self, void const* p)
+{
+    struct alloc_record* rec = probe(self->slots, self->capacity, p);
+    if (rec) return rec;
+    return probe(self->old_slots, self->old_capacity, p);
+}
+
+bool
+alloc_table_insert(struct alloc_table* self, struct alloc_record const* new_rec)
+{
+    void const* p = new_rec->pointer;
+
+    struct alloc_record* rec = probe(self->slots, self->capacity, p);
+    if (rec) {
+        *rec = *new_rec;
+        return true;
+    }
+
+    rec = probe(self->old_slots, self->old_capacity, p);
+    if (rec) {
+        rec->pointer = TOMBSTONE;
+        --self->old_count;
+    }
+
+    if (4 * (self->count + self->old_count + 1) > 3 * self->capacity &&
+            !grow(self))
+        return false;
+
+    place(self, *new_rec);
+    migrate_some(self, MIGRATE_STEP);
+    return true;
+}
+
+bool
+alloc_table_remove(struct alloc_table* self, void const* p,
+                   struct alloc_record* out)
+{
+    struct alloc_record* rec = probe(self->slots, self->capacity, p);
+
+    if (rec) {
+        if (out) *out = *rec;
+        delete_at(self, (size_t) (rec - self->slots));
+    } else if ((rec = probe(self->old_slots, self->old_capacity, p))) {
+        if (out) *out = *rec;
+        rec->pointer = TOMBSTONE;
+        --self->old_count;
+    } else {
+        return false;
+    }
+
+    migrate_some(self, MIGRATE_STEP);
+    return true;
+}
+
+void
+alloc_table_for_each(struct alloc_table* self,
+                     void (*fn)(struct alloc_record const*, void* aux),
+                     void* aux)
+{
+    for (size_t i = 0; i < self->capacity; ++i)
+        if (self->slots[i].pointer)
+            fn(&self->slots[i], aux);
+
+    for (size_t i = self->migrated; i < self->old_capacity; ++i)
+        if (self->old_slots[i].pointer &&
+                self->old_slots[i].pointer != TOMBSTONE)
+            fn(&self->old_slots[i], aux);
+}
+
+void
+alloc_table_clear(struct alloc_table* self)
+{
+    free(self->slots);
+    free(self->old_slots);
+    *self = (struct alloc_table) ALLOC_TABLE_INIT;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct alloc_site;
+
+// What we remember about each live allocation.
+struct alloc_record
+{
+    void*  pointer;
+    size_t size;
+
+    // The limit epoch the block was charged against, or 0 if it wasn't
+    // charged against any limit.
+    uint32_t epoch;
+
+    // The heap snapshot generation it was allocated in (see
+    // alloc_snapshot.h).
+    uint32_t generation;
+
+    // Where it was allocated, if known.
+    struct alloc_site* site;
+};
+
+// An open-addressing (linear probing) hash table mapping allocated
+// pointers to their records.
+//
+// Growing is incremental: when the table gets too full we allocate a
+// new array twice the size and then move a few slots from the old
+// array on every subsequent update, so no single call ever pays to
+// rehash the whole table.
+struct alloc_table
+{
+    struct alloc_record* slots;
+    size_t capacity;            // always a power of two (or 0)
+    size_t count;
+
+    // While a resize is in progress, the previous array. Entries are
+    // migrated in index order, and entries removed from it are replaced
+    // by tombstones so that migration never misses an entry.
+    struct alloc_record* old_slots;
+    size_t old_capacity;
+    size_t old_count;
+    size_t migrated;            // index of next old slot to migrate
+};
+
+#define ALLOC_TABLE_INIT  { NULL, 0, 0, NULL, 0, 0, 0 }
+
+// Returns the record for `pointer`, or NULL if it isn't in the table.
+// The record remains valid until the next update to the table.
+struct alloc_record*
+alloc_table_find(struct alloc_table*, void const* pointer);
+
+// Adds (or replaces) a record, keyed on its `pointer`. Returns false
+// if memory for the table itself could not be allocated.
+bool
+alloc_table_insert(struct alloc_table*, struct alloc_record const*);
+
+// Removes the record for `pointer`, storing it in `*out` (if `out` is
+// non-NULL). Returns false if `pointer` wasn't in the table.
+bool
+alloc_table_remove(struct alloc_table*, void const* pointer,
+                   struct alloc_record* out);
+
+// Calls `fn` on every record in the table, in no particular order. `fn`
+// must not update the table.
+void
+alloc_table_for_each(struct alloc_table*,
+                     void (*fn)(struct alloc_record const*, void* aux),
+                     void* aux);
+
+// Removes every record and releases the table's memory.
+void
+alloc_table_clear(struct alloc_table*);
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+
+#include "alloc_env.h"
+#include "alloc_sites.h"
+#include "alloc_timeline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_EVERY   1000
+
+// When we have this many snapshots, we drop every other one and take
+// them half as often from then on.
+#define MAX_SNAPSHOTS   512
+
+// A new peak gets a snapshot only if it's this many 1024ths above the
+// last one, so a heap that creeps upward isn't snapshotted every call.
+#define PEAK_STEP       16
+
+// The peak snapshot lists this many sites, and lumps the rest together.
+#define PEAK_SITES      25
+
+struct site_bytes
+{
+    struct alloc_site const* site;
+    size_t bytes;
+};
+
+struct snapshot
+{
+    uint64_t time;          // ms since start, or allocation calls
+    size_t   live_bytes;    // requested
+    size_t   extra_bytes;   // usable beyond requested
+    size_t   total_bytes;
+
+    // For the peak snapshot, the live bytes of the biggest sites.
+    struct site_bytes* sites;
+    size_t             nsites;
+    size_t             other_bytes;
+    size_t             other_sites;
+};
+
+static pthread_once_t  timeline_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE*  massif_out = NULL;
+static FILE*  csv_out    = NULL;
+static pid_t  owner;                // only this process writes at exit
+
+static bool     by_time;            // else by allocation calls
+static uint64_t period;             // in ms or calls
+static uint64_t start_ns;
+
+static _Atomic uint64_t calls;
+static _Atomic size_t   live_requested;
+static _Atomic size_t   live_usable;
+static _Atomic size_t   total_requested;
+static _Atomic uint64_t next_due;
+static _Atomic size_t   next_peak;  // live bytes that make a new peak
+
+// Set once we start writing, since under lib211-preload.so, writing
+// allocates through our own wrappers.
+static _Atomic bool     finished;
+
+static struct snapshot snapshots[MAX_SNAPSHOTS];
+static size_t nsnapshots = 0;
+static size_t peak_index = SIZE_MAX;
+
+static void write_timeline(void);
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t
+now(void)
+{
+    return by_time ? (now_ns() - start_ns) / 1000000
+                   : atomic_load_explicit(&calls, memory_order_relaxed);
+}
+
+static void
+timeline_init(void)
+{
+    massif_out = rt211_env_output("RT211_HEAP_MASSIF");
+    csv_out    = rt211_env_output("RT211_HEAP_CSV");
+    if (!massif_out && !csv_out) return;
+
+    size_t n;
+
+    if (rt211_env_size("RT211_HEAP_INTERVAL", &n) && n) {
+        by_time = true;
+        period  = n;
+    } else {
+        by_time = false;
+        period  = rt211_env_size("RT211_HEAP_EVERY", &n) && n
+                  ? n : DEFAULT_EVERY;
+    }
+
+    owner    = getpid();
+    start_ns = now_ns();
+    next_due = 0;
+
+    atexit(&write_timeline);
+}
+
+bool rt211_timeline_enabled(void)
+{
+    pthread_once(&timeline_once, &timeline_init);
+    return massif_out || csv_out;
+}
+
+static int
+compare_by_bytes(void const* a, void const* b)
+{
+    size_t x = ((struct site_bytes const*) a)->bytes,
+           y = ((struct site_bytes const*) b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+struct site_collector
+{
+    struct site_bytes* sites;
+    size_t count;
+    size_t capacity;
+};
+
+static void
+collect_site(struct alloc_site* site, void* aux)
+{
+    struct site_collector* c = aux;
+    size_t bytes = site->live_bytes;
+
+    if (!bytes) return;
+
+    if (c->count == c->capacity) {
+        size_t capacity = c->capacity ? 2 * c->capacity : 64;
+        struct site_bytes* sites = realloc(c->sites,
+                                           capacity * sizeof *sites);
+        if (!sites) return;
+        c->sites    = sites;
+        c->capacity = capacity;
+    }
+
+    c->sites[c->count++] = (struct site_bytes) { site, bytes };
+}
+
+// Breaks down the heap by site into `snap`.
+static void
+take_sites(struct snapshot* snap)
+{
+    struct site_collector c = { NULL, 0, 0 };
+    rt211_sites_for_each(&collect_site, &c);
+
+    if (c.count) qsort(c.sites, c.count, sizeof *c.sites, &compare_by_bytes);
+
+    snap->sites  = c.sites;
+    snap->nsites = c.count < PEAK_SITES ? c.count : PEAK_SITES;
+
+    for (size_t i = snap->nsites; i < c.count; ++i) {
+        snap->other_bytes += c.sites[i].bytes;
+        ++snap->other_sites;
+    }
+}
+
+// Halves the number of snapshots, keeping the peak.
+static void
+thin_snapshots(void)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < nsnapshots; ++i) {
+        if (i % 2 && i != peak_index) continue;
+        if (i == peak_index) peak_index = kept;
+        snapshots[kept++] = snapshots[i];
+    }
+
+    nsnapshots = kept;
+    period *= 2;
+}
+
+// Takes a snapshot, which is the new peak if `peak`. A new peak right
+// after the last one replaces it. Call with `timeline_lock` held.
+static void
+take_snapshot(bool peak)
+{
+    if (peak && nsnapshots && peak_index == nsnapshots - 1) {
+        free(snapshots[--nsnapshots].sites);
+        peak_index = SIZE_MAX;
+    }
+
+    if (nsnapshots == MAX_SNAPSHOTS) thin_snapshots();
+    if (nsnapshots == MAX_SNAPSHOTS) return;
+
+    struct snapshot* snap = &snapshots[nsnapshots];
+    size_t live   = atomic_load_explicit(&live_requested, memory_order_relaxed);
+    size_t usable = atomic_load_explicit(&live_usable, memory_order_relaxed);
+
+    *snap = (struct snapshot) {
+        .time        = now(),
+        .live_bytes  = live,
+        .extra_bytes = usable > live ? usable - live : 0,
+        .total_bytes = atomic_load_explicit(&total_requested,
+                                            memory_order_relaxed),
+    };
+
+    if (peak) {
+        if (peak_index < nsnapshots) {
+            free(snapshots[peak_index].sites);
+            snapshots[peak_index].sites = NULL;
+        }
+
+        peak_index = nsnapshots;
+        if (rt211_sites_enabled()) take_sites(snap);
+
+        size_t step = snap->live_bytes / 1024 * PEAK_STEP;
+        atomic_store_explicit(&next_peak, snap->live_bytes + (step ? step : 1),
+                              memory_order_relaxed);
+    }
+
+    ++nsnapshots;
+}
+
+void rt211_timeline_alloc(size_t requested, size_t usable)
+{
+    atomic_fetch_add_explicit(&live_requested, requested, memory_order_relaxed);
+    atomic_fetch_add_explicit(&live_usable, usable, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total_requested, requested,
+                              memory_order_relaxed);
+}
+
+void rt211_timeline_free(size_t requested, size_t usable)
+{
+    atomic_fetch_sub_explicit(&live_requested, requested, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&live_usable, usable, memory_order_relaxed);
+}
+
+void rt211_timeline_tick(void)
+{
+    if (atomic_load_explicit(&finished, memory_order_relaxed)) return;
+
+    uint64_t call = 1 + atomic_fetch_add_explicit(&calls, 1,
+                                                  memory_order_relaxed);
+    uint64_t t    = by_time ? now() : call;
+    size_t   live = atomic_load_explicit(&live_requested,
+                                         memory_order_relaxed);
+
+    bool due  = t >= atomic_load_explicit(&next_due, memory_order_relaxed);
+    bool peak = live >= atomic_load_explicit(&next_peak, memory_order_relaxed);
+
+    if (!due && !peak) return;
+
+    int saved_errno = errno;
+    pthread_mutex_lock(&timeline_lock);
+
+    // Another thread may have just taken care of it.
+    if (t >= next_due) {
+        take_snapshot(false);
+        atomic_store_explicit(&next_due, t - t % period + period,
+                              memory_order_relaxed);
+    }
+
+    if (live >= next_peak) take_snapshot(true);
+
+    pthread_mutex_unlock(&timeline_lock);
+    errno = saved_errno;
+}
+
+static void
+write_massif_tree(struct snapshot const* snap)
+{
+    size_t children = snap->nsites + (snap->other_sites != 0);
+
+    fprintf(massif_out, "n%zu: %zu (heap allocation functions) "
+                        "malloc/new/new[], --alloc-fns, etc.\n",
+            children, snap->live_bytes);
+
+    for (size_t i = 0; i < snap->nsites; ++i) {
+        char name[256];
+        rt211_site_name(snap->sites[i].site, name, sizeof name);
+        fprintf(massif_out, " n0: %zu 0x%X: %s\n",
+                snap->sites[i].bytes, (unsigned) snap->sites[i].site->id,
+                name);
+    }
+
+    if (snap->other_sites) {
+        fprintf(massif_out, " n0: %zu in %zu places, all below massif's "
+                            "threshold (listing the top %d)\n",
+                snap->other_bytes, snap->other_sites, PEAK_SITES);
+    }
+}
+
+static void
+write_massif(void)
+{
+    fprintf(massif_out, "desc: lib211 heap timeline\n");
+    fprintf(massif_out, "cmd: %s\n", program_invocation_name);
+    fprintf(massif_out, "time_unit: %s\n", by_time ? "ms" : "i");
+
+    for (size_t i = 0; i < nsnapshots; ++i) {
+        struct snapshot const* snap = &snapshots[i];
+
+        fprintf(massif_out, "#-----------\nsnapshot=%zu\n#-----------\n", i);
+        fprintf(massif_out, "time=%llu\n", (unsigned long long) snap->time);
+        fprintf(massif_out, "mem_heap_B=%zu\n", snap->live_bytes);
+        fprintf(massif_out, "mem_heap_extra_B=%zu\n", snap->extra_bytes);
+        fprintf(massif_out, "mem_stacks_B=0\n");
+
+        if (i == peak_index) {
+            fprintf(massif_out, "heap_tree=peak\n");
+            write_massif_tree(snap);
+        } else {
+            fprintf(massif_out, "heap_tree=empty\n");
+        }
+    }
+}
+
+static void
+write_csv(void)
+{
+    fprintf(csv_out, "%s,live_bytes,total_bytes,peak\n",
+            by_time ? "time_ms" : "calls");
+
+    for (size_t i = 0; i < nsnapshots; ++i) {
+        fprintf(csv_out, "%llu,%zu,%zu,%d\n",
+                (unsigned long long) snapshots[i].time,
+                snapshots[i].live_bytes,
+                snapshots[i].total_bytes,
+                i == peak_index);
+    }
+}
+
+static void
+write_timeline(void)
+{
+    if (getpid() != owner) return;
+
+    pthread_mutex_lock(&timeline_lock);
+
+    take_snapshot(false);
+    finished = true;
+
+    if (massif_out) {
+        write_massif();
+        rt211_env_close(massif_out);
+        massif_out = NULL;
+    }
+
+    if (csv_out) {
+        write_csv();
+        rt211_env_close(csv_out);
+        csv_out = NULL;
+    }
+
+    pthread_mutex_unlock(&timeline_lock);
+}
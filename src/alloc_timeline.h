@@ -0,0 +1,25 @@
+#pragma once
+
+// A timeline of live heap bytes. Setting RT211_HEAP_MASSIF writes it in
+// Valgrind Massif's format, for ms_print(1) or massif-visualizer, and
+// setting RT211_HEAP_CSV writes it as CSV (each to a file name or
+// `&fd`), at exit. Snapshots are taken every RT211_HEAP_EVERY
+// allocation calls (default 1000) or, if RT211_HEAP_INTERVAL is set,
+// every that many milliseconds, plus whenever the heap reaches a new
+// peak. The last peak snapshot breaks the heap down by call site.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Is the timeline turned on?
+bool rt211_timeline_enabled(void);
+
+// Counts a block of `requested` bytes, of which `usable` bytes are
+// usable, coming into or going out of existence. The timeline shows
+// requested bytes as the heap and the rest as the allocator's extra.
+void rt211_timeline_alloc(size_t requested, size_t usable);
+void rt211_timeline_free(size_t requested, size_t usable);
+
+// Notes that an allocation function just ran, which may be time for a
+// snapshot. (Call after counting the block.)
+void rt211_timeline_tick(void);
@@ -0,0 +1,657 @@
+#define _XOPEN_SOURCE 700
+
+#include "alloc_env.h"
+#include "alloc_sites.h"
+#include "alloc_table.h"
+#include "alloc_trace.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/single_threaded.h>
+#include <time.h>
+#include <unistd.h>
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static FILE* trace_out = NULL;
+static bool  trace_bin = false;
+
+// Whether RT211_TRACE uses `%p` to give each process its own trace.
+static bool  trace_per_process = false;
+
+// Delta-coding state for the binary format; protected by the lock
+// on `trace_out`.
+static struct trace_codec trace_codec;
+
+static _Atomic uint32_t next_thread = 1;
+
+// With RT211_TRACE_ASYNC set, records go into a bounded lock-free
+// ring (Vyukov's MPMC queue, though we only have one consumer) that a
+// background thread drains to `trace_out`. RT211_TRACE_ASYNC=drop
+// discards records when the ring is full, whereas =block makes the
+// allocating thread wait for room. RT211_TRACE_RING sets the number of
+// records the ring holds.
+#define DEFAULT_RING_SIZE  ((size_t) 1 << 16)
+#define WRITER_NAP_NS      200000
+
+struct ring_cell
+{
+    _Atomic size_t      seq;
+    struct trace_record rec;
+};
+
+static struct ring_cell* ring = NULL;
+static size_t            ring_mask;
+static bool              ring_drops;
+static _Atomic size_t    ring_head;         // next slot to fill
+static size_t            ring_tail;         // next slot to drain
+static _Atomic size_t    ring_dropped;
+
+static pthread_t         writer;
+static bool              writer_running = false;
+static _Atomic bool      writer_stop    = false;
+
+// Instead of tracing every call, we can trace only some:
+//
+//   RT211_TRACE_EVERY=N         every Nth allocating call
+//   RT211_TRACE_SAMPLE_BYTES=N  Poisson sampling, once per N bytes
+//                               allocated on average (as in tcmalloc),
+//                               so large blocks are nearly always seen
+//   RT211_TRACE_SIZES=MIN-MAX   only blocks in this size range (either
+//                               end may be omitted)
+//   RT211_TRACE_OPS=OP,...      only these ops (malloc, calloc, realloc,
+//                               reallocf, free, aligned_alloc)
+//
+// If both sampling variables are set, RT211_TRACE_SAMPLE_BYTES takes
+// precedence. Each allocating call (realloc included) is chosen on its
+// own, and a free is traced if the call that allocated its block was.
+// Sampled records carry a weight, the number of calls each stands for,
+// so summing weights estimates the calls of each op. Blocks we've chosen
+// are kept in `chosen`, along with the size that decided their weight.
+// RT211_TRACE_OPS only decides which of the chosen calls are written.
+static bool     selective    = false;
+static bool     choosing     = false;   // sampling or RT211_TRACE_SIZES
+static size_t   sample_every = 0;
+static size_t   sample_bytes = 0;
+static size_t   min_size     = 0;
+static size_t   max_size     = SIZE_MAX;
+static unsigned op_mask      = ~0u;
+
+static pthread_mutex_t    chosen_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct alloc_table chosen      = ALLOC_TABLE_INIT;
+
+// The size of `chosen`, readable without the lock, so that freeing
+// doesn't need to take it when there's nothing to find.
+static _Atomic size_t     chosen_count = 0;
+
+static _Thread_local struct
+{
+    uint32_t thread;
+    bool     denied;
+    size_t   denied_bytes;
+    size_t   remaining;
+
+    // Sampling state:
+    size_t   until_sample;      // calls or bytes, per the sampling mode
+    uint64_t random;
+}       trace_local;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void
+write_record(struct trace_record const* rec)
+{
+    if (trace_bin) {
+        trace_write(&trace_codec, rec, trace_out);
+    } else {
+        trace_print_text(trace_out, rec);
+    }
+}
+
+static void
+ring_reset(void)
+{
+    for (size_t i = 0; i <= ring_mask; ++i)
+        ring[i].seq = i;
+
+    ring_head = ring_tail = 0;
+}
+
+static void
+ring_push(struct trace_record const* rec)
+{
+    size_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    struct ring_cell* cell;
+
+    for (;;) {
+        cell = &ring[pos & ring_mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                        &ring_head, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Full.
+            if (ring_drops) {
+                ++ring_dropped;
+                return;
+            }
+
+            sched_yield();
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        } else {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    cell->rec = *rec;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+}
+
+// Writes out everything in the ring; returns whether there was any.
+static bool
+ring_drain(void)
+{
+    bool any = false;
+
+    for (;;) {
+        struct ring_cell* cell = &ring[ring_tail & ring_mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        if (seq != ring_tail + 1) break;
+
+        write_record(&cell->rec);
+        atomic_store_explicit(&cell->seq, ring_tail + ring_mask + 1,
+                              memory_order_release);
+        ++ring_tail;
+        any = true;
+    }
+
+    return any;
+}
+
+static void*
+writer_main(void* unused)
+{
+    (void) unused;
+
+    struct timespec nap = { 0, WRITER_NAP_NS };
+
+    for (;;) {
+        bool stopping = writer_stop;
+        if (ring_drain()) continue;
+        if (stopping) break;
+        fflush(trace_out);
+        nanosleep(&nap, NULL);
+    }
+
+    return NULL;
+}
+
+static void
+start_writer(void)
+{
+    writer_stop    = false;
+    writer_running = !pthread_create(&writer, NULL, &writer_main, NULL);
+
+    // Fall back to writing synchronously.
+    if (!writer_running) {
+        free(ring);
+        ring = NULL;
+    }
+}
+
+static void
+stop_writer(void)
+{
+    if (!writer_running) return;
+
+    writer_stop = true;
+    pthread_join(writer, NULL);
+    writer_running = false;
+
+    size_t dropped = ring_dropped;
+    if (dropped) {
+        fprintf(stderr, "lib211_alloc: dropped %zu trace records "
+                        "(RT211_TRACE_ASYNC=drop)\n", dropped);
+    }
+}
+
+static void
+close_trace_out(void)
+{
+    stop_writer();
+
+    if (trace_out) {
+        fclose(trace_out);
+        trace_out = NULL;
+    }
+}
+
+// The writer thread doesn't survive fork(2), so the child gets a new
+// one, and the parent's pending records are left for the parent. A text
+// trace without `%p` is shared, each process appending its own lines,
+// but two processes delta-coding into one binary trace would garble it,
+// so then the child starts a file of its own (see
+// `rt211_env_child_output`). The parent's stream was flushed just
+// before the fork, so closing the child's copy of it writes nothing.
+//
+// We hold `trace_out`'s lock across the fork so that no other thread is
+// halfway through a record. The child has to let go of its copy of the
+// lock, which is still held by the forking thread, or any other thread
+// it starts will block on it for good--except that glibc resets every
+// stream lock in the child of a multithreaded process, so then the
+// child must not unlock it again. This is why `before_fork` notes which
+// case the fork is.
+static bool fork_resets_locks;
+
+static void
+before_fork(void)
+{
+    if (!trace_out) return;
+    pthread_mutex_lock(&chosen_lock);
+    flockfile(trace_out);
+    fflush(trace_out);
+
+    // Once a process has had a second thread, glibc counts it as
+    // multithreaded for good, as does this flag.
+    fork_resets_locks = !__libc_single_threaded;
+}
+
+static void
+after_fork_in_parent(void)
+{
+    if (!trace_out) return;
+    funlockfile(trace_out);
+    pthread_mutex_unlock(&chosen_lock);
+}
+
+static void write_bin_header(void);
+
+static void
+reopen_in_child(void)
+{
+    // Nothing is traced until the new file is ready, including what
+    // opening it allocates.
+    FILE* inherited = trace_out;
+    trace_out = NULL;
+    rt211_env_close(inherited);
+
+    FILE* out = rt211_env_child_output("RT211_TRACE");
+    if (!out && errno) {
+        perror("lib211_alloc: RT211_TRACE");
+        return;
+    } else if (!out) {
+        fprintf(stderr, "lib211_alloc: RT211_TRACE: not tracing process %ld, "
+                        "which can't share a binary trace\n", (long) getpid());
+        return;
+    }
+
+    if (trace_bin) {
+        trace_codec_destroy(&trace_codec);
+        trace_out = out;
+        write_bin_header();
+    } else {
+        trace_out = out;
+    }
+}
+
+static void
+after_fork_in_child(void)
+{
+    if (!trace_out) return;
+    if (!fork_resets_locks) funlockfile(trace_out);
+    pthread_mutex_unlock(&chosen_lock);
+
+    if (trace_per_process || trace_bin) reopen_in_child();
+
+    if (ring && trace_out) {
+        // The parent's records that were still in the ring are the
+        // parent's to write.
+        ring_reset();
+        ring_dropped = 0;
+        start_writer();
+    }
+}
+
+static void
+async_init(char const* policy)
+{
+    size_t size = DEFAULT_RING_SIZE;
+
+    char const* size_str = getenv("RT211_TRACE_RING");
+    if (size_str) {
+        unsigned long n = strtoul(size_str, NULL, 10);
+        size = 2;
+        while (size < n && size < ((size_t) 1 << 30)) size *= 2;
+    }
+
+    ring = malloc(size * sizeof *ring);
+    if (!ring) return;
+
+    ring_mask  = size - 1;
+    ring_drops = strcmp(policy, "block") != 0;
+    ring_reset();
+    start_writer();
+}
+
+static void
+write_bin_header(void)
+{
+    struct trace_file_header header = {
+        .version  = TRACE_VERSION,
+        .pid      = (uint32_t) getpid(),
+        .ppid     = (uint32_t) getppid(),
+        .start_ns = now_ns(),
+    };
+    memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+
+    trace_codec.time_ns = header.start_ns;
+    trace_codec.pointer = 0;
+
+    // A process that leaves with _exit(2) loses what's buffered, but
+    // its trace should still be readable.
+    fwrite(&header, sizeof header, 1, trace_out);
+    fflush(trace_out);
+}
+
+static bool
+parse_op(char const* name, size_t len, unsigned* mask)
+{
+    static char const* const names[] = {
+        [TRACE_MALLOC]   = "malloc",
+        [TRACE_CALLOC]   = "calloc",
+        [TRACE_REALLOC]  = "realloc",
+        [TRACE_REALLOCF] = "reallocf",
+        [TRACE_FREE]     = "free",
+        [TRACE_MEMALIGN] = "aligned_alloc",
+    };
+
+    for (unsigned op = TRACE_MALLOC; op <= TRACE_MEMALIGN; ++op) {
+        if (names[op] && strlen(names[op]) == len && strncmp(name, names[op], len) == 0) {
+            *mask |= 1u << op;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+selection_init(void)
+{
+    char const* sizes = getenv("RT211_TRACE_SIZES");
+    if (sizes && *sizes) {
+        char* end;
+        char const* dash = strchr(sizes, '-');
+        if (!dash) rt211_env_invalid("RT211_TRACE_SIZES", sizes);
+
+        if (dash != sizes) {
+            min_size = strtoul(sizes, &end, 10);
+            if (end != dash) rt211_env_invalid("RT211_TRACE_SIZES", sizes);
+        }
+
+        if (dash[1]) {
+            max_size = strtoul(dash + 1, &end, 10);
+            if (*end) rt211_env_invalid("RT211_TRACE_SIZES", sizes);
+        }
+
+        selective = true;
+    }
+
+    char const* ops = getenv("RT211_TRACE_OPS");
+    if (ops && *ops) {
+        op_mask = 0;
+
+        for (char const* op = ops; *op; ) {
+            size_t len = strcspn(op, ",");
+            if (!parse_op(op, len, &op_mask))
+                rt211_env_invalid("RT211_TRACE_OPS", ops);
+            op += len;
+            if (*op) ++op;
+        }
+
+        selective = true;
+    }
+
+    if (!rt211_env_size("RT211_TRACE_SAMPLE_BYTES", &sample_bytes) &&
+            rt211_env_size("RT211_TRACE_EVERY", &sample_every) &&
+            sample_every < 2)
+        sample_every = 0;
+
+    choosing = sample_bytes || sample_every ||
+               min_size > 0 || max_size < SIZE_MAX;
+    if (choosing) selective = true;
+}
+
+static void
+tracing_init(void)
+{
+    atexit(&close_trace_out);
+
+    trace_out = rt211_env_output("RT211_TRACE");
+    trace_per_process = rt211_env_per_process("RT211_TRACE");
+
+    const char* format = getenv("RT211_TRACE_FORMAT");
+    trace_bin = format && strcmp(format, "bin") == 0;
+
+    if (!trace_out) return;
+
+    if (trace_bin) write_bin_header();
+
+    selection_init();
+
+    pthread_atfork(&before_fork, &after_fork_in_parent, &after_fork_in_child);
+
+    const char* async = getenv("RT211_TRACE_ASYNC");
+    if (async && *async) async_init(async);
+}
+
+bool
+rt211_trace_enabled(void)
+{
+    pthread_once(&trace_once, &tracing_init);
+    return trace_out != NULL;
+}
+
+void
+rt211_trace_denied(size_t n, size_t remaining)
+{
+    if (!rt211_trace_enabled()) return;
+
+    trace_local.denied       = true;
+    trace_local.denied_bytes = n;
+    trace_local.remaining    = remaining;
+}
+
+// Returns a random number in (0, 1] (xorshift64*).
+static double
+next_random(void)
+{
+    uint64_t x = trace_local.random;
+    if (!x) x = now_ns() ^ (uintptr_t) &trace_local ^ UINT64_C(0x9e3779b97f4a7c15);
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    trace_local.random = x;
+
+    return (double) ((x * UINT64_C(0x2545f4914f6cdd1d) >> 11) + 1) / 0x1p53;
+}
+
+// Bytes until the next sample: exponentially distributed, so samples
+// form a Poisson process over the bytes allocated.
+static size_t
+next_sample_interval(void)
+{
+    return (size_t) (-log(next_random()) * (double) sample_bytes) + 1;
+}
+
+// The number of allocations of `bytes` bytes that a sample of one
+// stands for: the inverse of the chance that sampling picks it.
+static double
+weight_of(size_t bytes)
+{
+    if (sample_bytes)
+        return bytes ? 1 / -expm1(-(double) bytes / (double) sample_bytes) : 1;
+    else if (sample_every)
+        return (double) sample_every;
+    else
+        return 1;
+}
+
+// Decides whether to trace a new block of `bytes` bytes.
+static bool
+sample(size_t bytes)
+{
+    if (bytes < min_size || bytes > max_size) return false;
+
+    size_t cost = sample_bytes ? bytes : sample_every ? 1 : 0;
+    if (!cost) return true;
+
+    if (!trace_local.until_sample) {
+        trace_local.until_sample = sample_bytes
+                                   ? next_sample_interval() : sample_every;
+    }
+
+    if (cost < trace_local.until_sample) {
+        trace_local.until_sample -= cost;
+        return false;
+    }
+
+    trace_local.until_sample = 0;
+    return true;
+}
+
+static bool
+forget_chosen(void const* p, size_t* size)
+{
+    struct alloc_record rec;
+
+    if (!p || !atomic_load_explicit(&chosen_count, memory_order_relaxed))
+        return false;
+
+    pthread_mutex_lock(&chosen_lock);
+    bool found = alloc_table_remove(&chosen, p, &rec);
+    if (found) --chosen_count;
+    pthread_mutex_unlock(&chosen_lock);
+
+    if (found) *size = rec.size;
+    return found;
+}
+
+static void
+remember_chosen(void const* p, size_t size)
+{
+    struct alloc_record rec = { .pointer = (void*) p, .size = size };
+
+    pthread_mutex_lock(&chosen_lock);
+    if (alloc_table_insert(&chosen, &rec)) ++chosen_count;
+    pthread_mutex_unlock(&chosen_lock);
+}
+
+// Decides whether to trace a call when we're being selective, and
+// stores the record's weight in `*weight`. A free is chosen if its
+// block was, with the block's weight; every other call gets its own
+// chance, whatever became of the block it reallocates.
+static bool
+select_call(enum trace_op op,
+            size_t bytes,
+            void const* in,
+            void const* out,
+            double* weight)
+{
+    bool wanted = op_mask & 1u << op;
+    if (!choosing) return wanted;
+
+    size_t chosen_size;
+    bool   was_chosen = forget_chosen(in, &chosen_size);
+
+    if (op == TRACE_FREE) {
+        if (!was_chosen) return false;
+        *weight = weight_of(chosen_size);
+        return wanted;
+    }
+
+    // A failed realloc(3) leaves the block where it was.
+    if (was_chosen && !out && bytes && op != TRACE_REALLOCF)
+        remember_chosen(in, chosen_size);
+
+    bool is_chosen = sample(bytes);
+    if (is_chosen && out) remember_chosen(out, bytes);
+
+    *weight = weight_of(bytes);
+    return is_chosen && wanted;
+}
+
+void
+rt211_trace_op(enum trace_op op,
+               size_t count,
+               size_t size,
+               void const* in,
+               void const* out,
+               struct alloc_site const* site)
+{
+    if (!rt211_trace_enabled()) return;
+
+    int    saved_errno = errno;
+    double weight      = 1;
+
+    if (selective &&
+            !select_call(op, (size_t) trace_op_bytes(op, count, size),
+                         in, out, &weight)) {
+        trace_local.denied = false;
+        errno = saved_errno;
+        return;
+    }
+
+    if (!trace_local.thread) trace_local.thread = next_thread++;
+
+    struct trace_record rec = {
+        .op      = (uint8_t) op,
+        .flags   = trace_local.denied ? TRACE_DENIED : 0,
+        .thread  = trace_local.thread,
+        .time_ns = trace_bin ? now_ns() : 0,
+        .count   = count,
+        .size    = size,
+        .in_ptr  = (uintptr_t) in,
+        .out_ptr = (uintptr_t) out,
+        .denied    = trace_local.denied_bytes,
+        .remaining = trace_local.remaining,
+        .weight    = weight,
+    };
+
+    if (sample_bytes || sample_every) rec.flags |= TRACE_SAMPLED;
+
+    if (site) {
+        rec.site = site->id;
+        rec.line = site->line;
+        rec.file = site->file;
+        rec.func = site->func;
+    }
+
+    trace_local.denied = false;
+
+    if (ring) {
+        ring_push(&rec);
+    } else {
+        // Keep other threads' records from landing in the middle of ours.
+        flockfile(trace_out);
+        write_record(&rec);
+        funlockfile(trace_out);
+    }
+
+    errno = saved_errno;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Allocation tracing, controlled by the RT211_TRACE, RT211_TRACE_FORMAT,
+// RT211_TRACE_ASYNC and RT211_TRACE_RING environment variables, and
+// optionally sampled or filtered by RT211_TRACE_EVERY,
+// RT211_TRACE_SAMPLE_BYTES, RT211_TRACE_SIZES and RT211_TRACE_OPS (see
+// alloc_trace.c).
+
+#include "alloc_trace_format.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct alloc_site;
+
+// Is tracing turned on?
+bool rt211_trace_enabled(void);
+
+// Notes that the allocation limit just refused `n` bytes with
+// `remaining` bytes left; this is reported with the current thread's
+// next traced call.
+void rt211_trace_denied(size_t n, size_t remaining);
+
+// Traces a call to an allocation function that took pointer `in`
+// (if any) and returned `out`, made from `site` (if known). Preserves
+// `errno`.
+void rt211_trace_op(enum trace_op op,
+                    size_t count,
+                    size_t size,
+                    void const* in,
+                    void const* out,
+                    struct alloc_site const* site);
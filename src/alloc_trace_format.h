@@ -0,0 +1,439 @@
+#pragma once
+
+// The binary allocation trace format, written by lib211 when
+// RT211_TRACE_FORMAT=bin and read back by rt211_trace_decode.
+//
+// A trace is a `struct trace_file_header` followed by variable-length
+// records. Each record starts with one byte holding the op in its low
+// nibble and flags in its high nibble, followed by unsigned LEB128
+// varints:
+//
+//     thread    small sequential thread number
+//     time      zigzag delta from the previous record's time (ns)
+//     site      call site id, or 0 if unknown
+//     count     calloc; for aligned_alloc, the alignment
+//     size      all but free
+//     in_ptr    realloc, reallocf, free (zigzag delta from last pointer)
+//     out_ptr   all but free (zigzag delta from last pointer)
+//     denied    if TRACE_DENIED: bytes the limit refused
+//     remaining ... and the remaining limit
+//
+// and then, if TRACE_SAMPLED, the record's sampling weight as a raw
+// 8-byte double.
+//
+// Before the first record that mentions a call site, a TRACE_SITE
+// record defines it: the op byte, then varints for its id and line,
+// then the file name and the function name, each as a varint length
+// followed by that many bytes.
+//
+// Times are CLOCK_MONOTONIC nanoseconds; the first delta is from
+// `start_ns` in the header. Everything is in the host's byte order.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC       "rt211trc"
+#define TRACE_VERSION     1
+
+// Longest possible encoding of one record (other than TRACE_SITE).
+#define TRACE_RECORD_MAX  (1 + 10 * 10 + 8)
+
+struct trace_file_header
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint32_t ppid;
+    uint32_t reserved;
+    uint64_t start_ns;
+};
+
+enum trace_op
+{
+    TRACE_MALLOC = 1,
+    TRACE_CALLOC,
+    TRACE_REALLOC,
+    TRACE_REALLOCF,
+    TRACE_FREE,
+    TRACE_SITE,     // defines a call site, not a call
+    TRACE_MEMALIGN, // aligned_alloc or posix_memalign
+};
+
+// Does `op` stand for a call (rather than TRACE_SITE)?
+static inline bool
+trace_op_is_call(uint8_t op)
+{
+    return (op >= TRACE_MALLOC && op <= TRACE_FREE) || op == TRACE_MEMALIGN;
+}
+
+// The number of bytes a call allocated (or tried to).
+static inline uint64_t
+trace_op_bytes(uint8_t op, uint64_t count, uint64_t size)
+{
+    return op == TRACE_CALLOC ? count * size : size;
+}
+
+// Record flags:
+#define TRACE_DENIED      0x1   // the allocation limit refused the request
+#define TRACE_SAMPLED     0x2   // the trace is sampled; see `weight`
+
+// One decoded record.
+struct trace_record
+{
+    uint8_t  op;
+    uint8_t  flags;
+    uint32_t thread;
+    uint64_t time_ns;
+    uint64_t count;
+    uint64_t size;
+    uint64_t in_ptr;
+    uint64_t out_ptr;
+    uint64_t denied;
+    uint64_t remaining;
+
+    // If TRACE_SAMPLED, how many calls like this one the record stands
+    // for, so that multiplying by it estimates totals for the whole run.
+    double   weight;
+
+    // Call site (if `site` isn't 0):
+    uint32_t    site;
+    int32_t     line;
+    char const* file;
+    char const* func;
+};
+
+struct trace_site_def
+{
+    int32_t line;
+    char*   file;
+    char*   func;
+};
+
+// The delta-coding state of one trace stream.
+struct trace_codec
+{
+    uint64_t time_ns;
+    uint64_t pointer;
+
+    // When encoding, which site ids have been defined so far; when
+    // decoding, their definitions. Both are indexed by site id.
+    uint8_t*               defined;
+    struct trace_site_def* sites;
+    size_t                 site_cap;
+};
+
+// Makes room for site `id` in `codec`. Returns false if out of memory.
+static inline bool
+trace_codec_reserve(struct trace_codec* codec, uint32_t id, bool decoding)
+{
+    if (id < codec->site_cap) return true;
+
+    size_t cap = codec->site_cap ? codec->site_cap : 64;
+    while (cap <= id) cap *= 2;
+
+    if (decoding) {
+        struct trace_site_def* sites =
+            realloc(codec->sites, cap * sizeof *sites);
+        if (!sites) return false;
+        memset(sites + codec->site_cap, 0,
+               (cap - codec->site_cap) * sizeof *sites);
+        codec->sites = sites;
+    } else {
+        uint8_t* defined = realloc(codec->defined, cap);
+        if (!defined) return false;
+        memset(defined + codec->site_cap, 0, cap - codec->site_cap);
+        codec->defined = defined;
+    }
+
+    codec->site_cap = cap;
+    return true;
+}
+
+// Releases the memory held by `codec` and resets it.
+static inline void
+trace_codec_destroy(struct trace_codec* codec)
+{
+    for (size_t i = 0; codec->sites && i < codec->site_cap; ++i) {
+        free(codec->sites[i].file);
+        free(codec->sites[i].func);
+    }
+
+    free(codec->defined);
+    free(codec->sites);
+    memset(codec, 0, sizeof *codec);
+}
+
+static inline bool
+trace_op_takes_pointer(uint8_t op)
+{
+    return op == TRACE_REALLOC || op == TRACE_REALLOCF || op == TRACE_FREE;
+}
+
+static inline uint8_t*
+trace_put_varint(uint8_t* out, uint64_t value)
+{
+    while (value >= 0x80) {
+        *out++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+static inline uint8_t*
+trace_put_delta(uint8_t* out, uint64_t* prev, uint64_t value)
+{
+    int64_t delta = (int64_t) (value - *prev);
+    *prev = value;
+    return trace_put_varint(out, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+}
+
+static inline void
+trace_write_string(FILE* out, char const* str)
+{
+    uint8_t buf[10];
+    size_t  len = str ? strlen(str) : 0;
+
+    fwrite(buf, 1, (size_t) (trace_put_varint(buf, len) - buf), out);
+    fwrite(str, 1, len, out);
+}
+
+// Encodes `rec` onto `out`, preceded by the definition of its site if
+// `out` hasn't seen that yet.
+static inline void
+trace_write(struct trace_codec* codec,
+            struct trace_record const* rec,
+            FILE* out)
+{
+    uint8_t  buf[TRACE_RECORD_MAX];
+    uint8_t* p = buf;
+
+    if (rec->site && trace_codec_reserve(codec, rec->site, false) &&
+            !codec->defined[rec->site])
+    {
+        *p++ = TRACE_SITE;
+        p = trace_put_varint(p, rec->site);
+        p = trace_put_varint(p, (uint32_t) rec->line);
+        fwrite(buf, 1, (size_t) (p - buf), out);
+        trace_write_string(out, rec->file);
+        trace_write_string(out, rec->func);
+
+        codec->defined[rec->site] = 1;
+        p = buf;
+    }
+
+    *p++ = (uint8_t) (rec->op | rec->flags << 4);
+    p = trace_put_varint(p, rec->thread);
+    p = trace_put_delta(p, &codec->time_ns, rec->time_ns);
+    p = trace_put_varint(p, rec->site);
+
+    if (rec->op == TRACE_CALLOC || rec->op == TRACE_MEMALIGN)
+        p = trace_put_varint(p, rec->count);
+    if (rec->op != TRACE_FREE)
+        p = trace_put_varint(p, rec->size);
+    if (trace_op_takes_pointer(rec->op))
+        p = trace_put_delta(p, &codec->pointer, rec->in_ptr);
+    if (rec->op != TRACE_FREE)
+        p = trace_put_delta(p, &codec->pointer, rec->out_ptr);
+
+    if (rec->flags & TRACE_DENIED) {
+        p = trace_put_varint(p, rec->denied);
+        p = trace_put_varint(p, rec->remaining);
+    }
+
+    if (rec->flags & TRACE_SAMPLED) {
+        memcpy(p, &rec->weight, sizeof rec->weight);
+        p += sizeof rec->weight;
+    }
+
+    fwrite(buf, 1, (size_t) (p - buf), out);
+}
+
+static inline bool
+trace_get_varint(FILE* in, uint64_t* out)
+{
+    uint64_t value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) return false;
+
+        value |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *out = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool
+trace_get_delta(FILE* in, uint64_t* prev, uint64_t* out)
+{
+    uint64_t zigzag;
+    if (!trace_get_varint(in, &zigzag)) return false;
+
+    int64_t delta = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+    *out = *prev += (uint64_t) delta;
+    return true;
+}
+
+static inline char*
+trace_read_string(FILE* in)
+{
+    uint64_t len;
+    if (!trace_get_varint(in, &len) || len > 1 << 16) return NULL;
+
+    char* str = malloc(len + 1);
+    if (!str) return NULL;
+
+    if (fread(str, 1, len, in) != len) {
+        free(str);
+        return NULL;
+    }
+
+    str[len] = 0;
+    return str;
+}
+
+static inline bool
+trace_read_site(struct trace_codec* codec, FILE* in)
+{
+    uint64_t id, line;
+
+    if (!trace_get_varint(in, &id) || id > UINT32_MAX ||
+            !trace_get_varint(in, &line) ||
+            !trace_codec_reserve(codec, (uint32_t) id, true))
+        return false;
+
+    struct trace_site_def* def = &codec->sites[id];
+    free(def->file);
+    free(def->func);
+
+    def->line = (int32_t) line;
+    def->file = trace_read_string(in);
+    def->func = def->file ? trace_read_string(in) : NULL;
+
+    return def->func != NULL;
+}
+
+// Reads the next call record from `in`, absorbing any site definitions
+// on the way. Returns false at end of file or if the record is
+// malformed.
+static inline bool
+trace_decode(struct trace_codec* codec, FILE* in, struct trace_record* rec)
+{
+    int c;
+
+    while ((c = getc(in)) == TRACE_SITE)
+        if (!trace_read_site(codec, in)) return false;
+
+    if (c == EOF) return false;
+
+    uint64_t thread = 0, site = 0;
+    memset(rec, 0, sizeof *rec);
+    rec->op    = (uint8_t) (c & 0xf);
+    rec->flags = (uint8_t) (c >> 4);
+    rec->count  = 1;
+    rec->weight = 1;
+
+    if (!trace_op_is_call(rec->op))
+        return false;
+
+    bool ok = trace_get_varint(in, &thread) &&
+              trace_get_delta(in, &codec->time_ns, &rec->time_ns) &&
+              trace_get_varint(in, &site) && site <= UINT32_MAX;
+    rec->thread = (uint32_t) thread;
+    rec->site   = (uint32_t) site;
+
+    if (ok && rec->site && rec->site < codec->site_cap &&
+            codec->sites[rec->site].file)
+    {
+        struct trace_site_def const* def = &codec->sites[rec->site];
+        rec->line = def->line;
+        rec->file = def->file;
+        rec->func = def->func;
+    }
+
+    if (ok && (rec->op == TRACE_CALLOC || rec->op == TRACE_MEMALIGN))
+        ok = trace_get_varint(in, &rec->count);
+    if (ok && rec->op != TRACE_FREE)
+        ok = trace_get_varint(in, &rec->size);
+    if (ok && trace_op_takes_pointer(rec->op))
+        ok = trace_get_delta(in, &codec->pointer, &rec->in_ptr);
+    if (ok && rec->op != TRACE_FREE)
+        ok = trace_get_delta(in, &codec->pointer, &rec->out_ptr);
+
+    if (ok && rec->flags & TRACE_DENIED) {
+        ok = trace_get_varint(in, &rec->denied) &&
+             trace_get_varint(in, &rec->remaining);
+    }
+
+    if (ok && rec->flags & TRACE_SAMPLED)
+        ok = fread(&rec->weight, sizeof rec->weight, 1, in) == 1;
+
+    return ok;
+}
+
+// Prints `rec` in the text trace format. Calls but free(3) are followed
+// by ` = ` and the pointer they returned, so that rt211_trace_replay can
+// match each block with its free.
+static inline void
+trace_print_text(FILE* out, struct trace_record const* rec)
+{
+    void* in_ptr  = (void*) (uintptr_t) rec->in_ptr;
+    void* out_ptr = (void*) (uintptr_t) rec->out_ptr;
+
+    switch (rec->op) {
+    case TRACE_MALLOC:
+        fprintf(out, "malloc(%" PRIu64 ")", rec->size);
+        break;
+
+    case TRACE_CALLOC:
+        fprintf(out, "calloc(%" PRIu64 ", %" PRIu64 ")",
+                rec->count, rec->size);
+        break;
+
+    case TRACE_REALLOC:
+        fprintf(out, "realloc(%p, %" PRIu64 ")", in_ptr, rec->size);
+        break;
+
+    case TRACE_REALLOCF:
+        fprintf(out, "reallocf(%p, %" PRIu64 ")", in_ptr, rec->size);
+        break;
+
+    case TRACE_FREE:
+        fprintf(out, "free(%p)", in_ptr);
+        break;
+
+    case TRACE_MEMALIGN:
+        fprintf(out, "aligned_alloc(%" PRIu64 ", %" PRIu64 ")",
+                rec->count, rec->size);
+        break;
+    }
+
+    if (rec->op != TRACE_FREE)
+        fprintf(out, " = %p", out_ptr);
+
+    if (rec->flags & TRACE_SAMPLED)
+        fprintf(out, " weight=%g", rec->weight);
+
+    if (rec->file && *rec->file)
+        fprintf(out, " @ %s:%" PRId32 " (%s)", rec->file, rec->line, rec->func);
+
+    fprintf(out, "\n");
+
+    if (rec->flags & TRACE_DENIED) {
+        fprintf(out,
+                "lib211_alloc: preventing allocation of %" PRIu64 " bytes "
+                "because\nremaining limit is %" PRIu64 "\n",
+                rec->denied, rec->remaining);
+    }
+}
@@ -0,0 +1,112 @@
+#include "211_arena.h"
+#include "lib211_alloc.h"
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+#define DEFAULT_CHUNK_SIZE  ((size_t) 64 << 10)
+#define ALIGNMENT           alignof(max_align_t)
+
+struct arena_chunk
+{
+    _Alignas(max_align_t) struct arena_chunk* prev;
+    size_t size;
+    size_t used;
+};
+
+#define CHUNK_DATA(C)  ((unsigned char*) ((C) + 1))
+
+struct lib211_arena
+{
+    struct arena_chunk* current;
+    size_t              chunk_size;
+};
+
+struct lib211_arena* lib211_arena_create(size_t chunk_size)
+{
+    struct lib211_arena* arena = malloc(sizeof *arena);
+    if (!arena) return NULL;
+
+    arena->current    = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE;
+    return arena;
+}
+
+static size_t
+align_up(size_t n)
+{
+    return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+// Adds a chunk with room for at least `size` bytes.
+static struct arena_chunk*
+add_chunk(struct lib211_arena* arena, size_t size)
+{
+    if (size < arena->chunk_size) size = arena->chunk_size;
+
+    if (size > SIZE_MAX - sizeof(struct arena_chunk)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    struct arena_chunk* chunk = malloc(sizeof *chunk + size);
+    if (!chunk) return NULL;
+
+    chunk->prev    = arena->current;
+    chunk->size    = size;
+    chunk->used    = 0;
+    arena->current = chunk;
+    return chunk;
+}
+
+void* lib211_arena_alloc(struct lib211_arena* arena, size_t size)
+{
+    if (size > SIZE_MAX - ALIGNMENT) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size = align_up(size);
+
+    struct arena_chunk* chunk = arena->current;
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        chunk = add_chunk(arena, size);
+        if (!chunk) return NULL;
+    }
+
+    void* result = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+    return result;
+}
+
+struct lib211_arena_mark lib211_arena_mark(struct lib211_arena const* arena)
+{
+    struct arena_chunk* chunk = arena->current;
+
+    return (struct lib211_arena_mark) {
+        .chunk = chunk,
+        .used  = chunk ? chunk->used : 0,
+    };
+}
+
+void lib211_arena_reset(struct lib211_arena* arena,
+                        struct lib211_arena_mark mark)
+{
+    while (arena->current && arena->current != mark.chunk) {
+        struct arena_chunk* prev = arena->current->prev;
+        free(arena->current);
+        arena->current = prev;
+    }
+
+    if (arena->current) arena->current->used = mark.used;
+}
+
+void lib211_arena_destroy(struct lib211_arena* arena)
+{
+    if (!arena) return;
+
+    lib211_arena_reset(arena, (struct lib211_arena_mark) { NULL, 0 });
+    free(arena);
+}
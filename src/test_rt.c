@@ -5,6 +5,7 @@
 
 #include "lib211_test.h"
 #include "lib211_io.h"
+#include "alloc_stats.h"
 #include "test_reporting.h"
 
 #include <ctype.h>
@@ -379,6 +380,60 @@ bool lib211_do_check_pointer(
     return false;
 }
 
+static size_t allocs_so_far(struct alloc_stats const* stats)
+{
+    return stats->malloc_calls + stats->calloc_calls + stats->realloc_calls;
+}
+
+// Budgets nest, since the peak each one saves and restores includes
+// whatever it was for the budget outside.
+struct lib211_alloc_budget lib211_budget_begin(
+        size_t max_allocs,
+        size_t max_peak,
+        const char* code,
+        const char* file,
+        int line)
+{
+    struct alloc_stats stats;
+    alloc_stats_get(&stats);
+
+    return (struct lib211_alloc_budget) {
+        .max_allocs   = max_allocs,
+        .max_peak     = max_peak,
+        .start_allocs = allocs_so_far(&stats),
+        .start_bytes  = stats.current_bytes,
+        .saved_peak   = rt211_stats_peak_restart(),
+        .code         = code,
+        .file         = file,
+        .line         = line,
+        .done         = false,
+    };
+}
+
+bool lib211_budget_end(struct lib211_alloc_budget* budget)
+{
+    struct alloc_stats stats;
+    alloc_stats_get(&stats);
+    rt211_stats_peak_resume(budget->saved_peak);
+    budget->done = true;
+
+    size_t allocs = allocs_so_far(&stats) - budget->start_allocs;
+    size_t peak   = stats.peak_bytes > budget->start_bytes
+                    ? stats.peak_bytes - budget->start_bytes : 0;
+
+    bool ok = allocs <= budget->max_allocs && peak <= budget->max_peak;
+    if (log_check(ok, budget->file, budget->line)) return true;
+
+    eprintf("  allocations: %zu", allocs);
+    if (budget->max_allocs != SIZE_MAX)
+        eprintf("  (budget: %zu)", budget->max_allocs);
+    eprintf("\n  peak bytes:  %zu", peak);
+    if (budget->max_peak != SIZE_MAX)
+        eprintf("  (budget: %zu)", budget->max_peak);
+    eprintf("\n  code: %s\n", budget->code);
+    return false;
+}
+
 _Noreturn void lib211_exit_rt(int result)
 {
     if (tests_enabled) {
@@ -0,0 +1,517 @@
+// Checks what the RT211_* environment variables make lib211 write, by
+// running build/alloc_workload under them and the tools in ../build/bin
+// on the results.
+
+#include <lib211_program_test.h>
+#include <lib211_test.h>
+
+#define TOOLS  "../build/bin/"
+
+// ASan would rather abort than have malloc(SIZE_MAX) return NULL, and
+// it warns even so, hence the trace workload's stderr is not checked.
+// LeakSanitizer complains about forking with a trace writer thread.
+#define WORKLOAD  "ASAN_OPTIONS=allocator_may_return_null=1:detect_leaks=0 " \
+                  "build/alloc_workload "
+
+// Call sites depend on line numbers, so we leave them out.
+#define NO_SITES  " | sed 's/ @ .*//'"
+
+static void test_text_trace(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/trace.txt "
+        WORKLOAD "trace >build/trace.out 2>/dev/null && "
+        "sed 's/ @ .*//' build/trace.txt | diff build/trace.out -",
+        "", "", "", 0);
+}
+
+static void test_binary_trace(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/trace.bin RT211_TRACE_FORMAT=bin "
+        WORKLOAD "trace >build/trace.out 2>/dev/null && "
+        TOOLS "rt211_trace_decode build/trace.bin" NO_SITES
+        " | diff build/trace.out -",
+        "", "", "", 0);
+}
+
+// Forking mustn't hang the background trace writer, and the child's
+// calls should land in the trace too.
+static void test_async_trace_fork(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/fork.txt RT211_TRACE_ASYNC=block "
+        "timeout 30 env " WORKLOAD "fork 2>&1 | sort >build/fork.out && "
+        "sed 's/ @ .*//' build/fork.txt | sort | diff build/fork.out -",
+        "", "", "", 0);
+}
+
+// A single-threaded parent's trace lock isn't reset in the child, so
+// unless the child lets go of it, a thread the child starts hangs.
+static void test_trace_fork_thread(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/tfork.txt "
+        "timeout 30 env " WORKLOAD "fork_thread >build/tfork.out 2>&1 && "
+        "sed 's/ @ .*//' build/tfork.txt | diff build/tfork.out -",
+        "", "", "", 0);
+}
+
+// Without `%p`, a forked child can't share the parent's binary trace,
+// so it writes the file name with its process ID appended.
+static void test_binary_trace_fork(void)
+{
+    CHECK_COMMAND(
+        "rm -f build/bfork.bin*; "
+        "RT211_TRACE=build/bfork.bin RT211_TRACE_FORMAT=bin "
+        WORKLOAD "fork >build/bfork.out 2>build/bfork.err && "
+        TOOLS "rt211_trace_decode build/bfork.bin" NO_SITES
+        " | diff build/bfork.out - && "
+        TOOLS "rt211_trace_decode build/bfork.bin.[0-9]*" NO_SITES
+        " | diff build/bfork.err -",
+        "", "", "", 0);
+}
+
+// With `%p`, each process writes its own trace, which rt211_trace_merge
+// puts back together: the child's calls come between the parent's.
+static void test_trace_merge(void)
+{
+    CHECK_COMMAND(
+        "rm -f build/merge.*.bin; "
+        "RT211_TRACE=build/merge.%p.bin RT211_TRACE_FORMAT=bin "
+        WORKLOAD "fork >build/merge.out 2>build/merge.err && "
+        "{ head -n 2 build/merge.out; cat build/merge.err; "
+        "  tail -n 2 build/merge.out; } >build/merge.want && "
+        TOOLS "rt211_trace_merge build/merge.*.bin >build/merge.txt && "
+        "sed -nE 's/^(# +process) [0-9]+ [(]parent [0-9]+[)] from [0-9.]+ ms/"
+        "\\1 P/p' build/merge.txt && "
+        "sed -nE '/^#/!s/^[[][0-9]+ [0-9]+ [0-9.]+[]] //p' build/merge.txt"
+        NO_SITES " | diff build/merge.want -",
+        "",
+        "# process P, 4 calls\n"
+        "#   process P, 4 calls\n",
+        "", 0);
+}
+
+// Each test that RUN_TEST runs forks.
+static void test_async_trace_run_test(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/tests.txt RT211_TRACE_ASYNC=drop "
+        "timeout 30 build/alloc_limit_test",
+        "", ANY_OUTPUT, ANY_OUTPUT, 0);
+}
+
+// Each op by itself, and two together, against the same calls traced
+// in full.
+static void test_trace_ops(void)
+{
+    CHECK_COMMAND(
+        "for ops in malloc calloc realloc reallocf free aligned_alloc "
+        "        malloc,free; do "
+        "    RT211_TRACE=build/ops.txt RT211_TRACE_OPS=$ops "
+        "    " WORKLOAD "trace >build/trace.out 2>/dev/null && "
+        "    grep -E \"^($(echo $ops | tr , '|'))[(]\" build/trace.out "
+        "        >build/ops.out; "
+        "    sed 's/ @ .*//' build/ops.txt | diff build/ops.out - || "
+        "        echo $ops; "
+        "done",
+        "", "", "", 0);
+}
+
+// Sums the weights of a sampled trace by op.
+#define WEIGHTS  " | sed -E 's/^([a-z_]+)[(].* weight=([0-9.e+]+).*/\\1 \\2/'" \
+                 " | awk '{ w[$1] += $2 } END { for (op in w) print op, w[op] }'" \
+                 " | sort"
+
+// Every 100th allocating call is chosen, reallocs included, and each
+// stands for 100. The last realloc isn't chosen, so neither is the free.
+static void test_trace_every(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/every.txt RT211_TRACE_EVERY=100 "
+        WORKLOAD "grow && cat build/every.txt" WEIGHTS,
+        "", "realloc 200\n", "", 0);
+}
+
+// Byte sampling should estimate the calls to within a few percent.
+static void test_trace_sample_bytes(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/sample.txt RT211_TRACE_SAMPLE_BYTES=1000 "
+        WORKLOAD "many && cat build/sample.txt" WEIGHTS
+        " | awk '{ print $1, ($2 > 17000 && $2 < 23000) }'",
+        "", "free 1\nmalloc 1\n", "", 0);
+}
+
+// A text trace for rt211_trace_replay: 1564 bytes requested in all,
+// 1364 at the peak, and the aligned block never freed.
+#define REPLAY_TRACE \
+    "malloc(100) = 0x1000\n" \
+    "calloc(2, 50) = 0x2000\n" \
+    "realloc(0x1000, 300) = 0x3000\n" \
+    "aligned_alloc(64, 64) = 0x4000\n" \
+    "free(0x2000)\n" \
+    "malloc(1000) = 0x5000\n" \
+    "free(0x3000)\n" \
+    "free(0x5000)\n"
+
+#define REPLAY_SUMMARY \
+    "calls:        8 (2 malloc, 1 calloc, 1 realloc, 1 aligned_alloc, " \
+    "3 free)\n" \
+    "requested:    peak 1364, total 1564, never freed 64 bytes\n" \
+    "live blocks:  at most 3\n"
+
+// Timings vary from run to run.
+#define NO_TIMES  " | sed -E 's/[0-9]+[.][0-9]+ (ms|ns)/T \\1/g'"
+
+// Only the malloc(1000) would take the heap over 1K.
+static void test_replay_peak_limit(void)
+{
+    CHECK_COMMAND(
+        TOOLS "rt211_trace_replay -l 1K",
+        REPLAY_TRACE,
+        REPLAY_SUMMARY
+        "limit:        peak 1024 bytes\n"
+        "denied:       1 calls, first call 6 (malloc of 1000 bytes)\n"
+        "under limit:  peak 464, total 564 bytes\n",
+        "", 0);
+}
+
+// The realloc is charged in full, using up the limit exactly, so both
+// allocations after it are refused.
+static void test_replay_total_limit(void)
+{
+    CHECK_COMMAND(
+        TOOLS "rt211_trace_replay -t 500 -",
+        REPLAY_TRACE,
+        REPLAY_SUMMARY
+        "limit:        total 500 bytes\n"
+        "denied:       2 calls, first call 4 (aligned_alloc of 64 bytes)\n"
+        "under limit:  peak 400, total 500 bytes\n",
+        "", 0);
+}
+
+// Replays a binary trace of the grow workload three times.
+static void test_replay_repeat(void)
+{
+    CHECK_COMMAND(
+        "RT211_TRACE=build/replay.bin RT211_TRACE_FORMAT=bin "
+        WORKLOAD "grow && "
+        TOOLS "rt211_trace_replay -r 3 build/replay.bin" NO_TIMES,
+        "",
+        "calls:        202 (1 malloc, 0 calloc, 200 realloc, "
+        "0 aligned_alloc, 1 free)\n"
+        "requested:    peak 201, total 20301, never freed 0 bytes\n"
+        "live blocks:  at most 1\n"
+        "allocator:    C library\n"
+        "time:         T ms (T ns/call), best of 3; mean T ms\n",
+        "", 0);
+}
+
+// glibc exports its allocator under a prefix too, which will do for
+// another allocator.
+static void test_replay_library(void)
+{
+    CHECK_COMMAND(
+        TOOLS "rt211_trace_replay -a libc.so.6 -p __libc_" NO_TIMES,
+        REPLAY_TRACE,
+        REPLAY_SUMMARY
+        "allocator:    libc.so.6\n"
+        "time:         T ms (T ns/call)\n",
+        "", 0);
+
+    CHECK_COMMAND(
+        TOOLS "rt211_trace_replay -a libc.so.6 -p no_such_",
+        REPLAY_TRACE,
+        ANY_OUTPUT,
+        "rt211_trace_replay: libc.so.6 doesn't define no_such_malloc and "
+        "no_such_free\n",
+        1);
+}
+
+// A limit is simulated, so it can't go with an allocator.
+static void test_replay_usage(void)
+{
+    CHECK_COMMAND(
+        TOOLS "rt211_trace_replay -l 1K -a libc.so.6",
+        "",
+        "",
+        "Usage: rt211_trace_replay [-r N] [-a LIB.so [-p PREFIX]] [FILE]\n"
+        "       rt211_trace_replay {-l | -t} LIMIT [FILE]\n",
+        2);
+}
+
+// Squeezes runs of spaces out of tables and line numbers out of sites.
+#define SQUEEZE  " | sed -E 's/ +/ /g; s/^ //; s/(alloc_workload[.]c):[0-9]+/\\1/'"
+
+static void test_sites(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_SITES='&1' " WORKLOAD "sites" SQUEEZE,
+        "",
+        "calls bytes live bytes peak live site\n"
+        "2 200 100 100 alloc_workload.c (big_block)\n"
+        "1 64 0 64 made_up.c:7 (made_up)\n"
+        "1 32 0 32 (unknown)\n"
+        "3 30 0 10 alloc_workload.c (small_blocks)\n",
+        "", 0);
+}
+
+static void test_leaks(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_LEAKS='&1' " WORKLOAD "sites" SQUEEZE,
+        "",
+        "lib211_alloc: 100 bytes in 1 blocks still allocated at exit\n"
+        "bytes blocks size site\n"
+        "100 1 100 alloc_workload.c (big_block)\n",
+        "", 0);
+}
+
+// Slack depends on the C library.
+static void test_histogram(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_HISTOGRAM='&1' " WORKLOAD "sizes"
+        " | sed -E 's/(\"slack[a-z_]*\"): [0-9]+/\\1: S/'",
+        "",
+        "{\n"
+        "  \"requests\": 6,\n"
+        "  \"requested_bytes\": 5204,\n"
+        "  \"slack_bytes\": S,\n"
+        "  \"max_request\": 5000,\n"
+        "  \"percentiles\": {\n"
+        "    \"p50\": 127,\n"
+        "    \"p90\": 5000,\n"
+        "    \"p99\": 5000,\n"
+        "    \"p999\": 5000\n"
+        "  },\n"
+        "  \"classes\": [\n"
+        "    { \"min\": 0, \"max\": 0, \"count\": 1, \"bytes\": 0, \"slack\": S },\n"
+        "    { \"min\": 1, \"max\": 1, \"count\": 1, \"bytes\": 1, \"slack\": S },\n"
+        "    { \"min\": 2, \"max\": 3, \"count\": 1, \"bytes\": 3, \"slack\": S },\n"
+        "    { \"min\": 64, \"max\": 127, \"count\": 2, \"bytes\": 200, \"slack\": S },\n"
+        "    { \"min\": 4096, \"max\": 8191, \"count\": 1, \"bytes\": 5000, \"slack\": S }\n"
+        "  ]\n"
+        "}\n",
+        "", 0);
+}
+
+// ASan's realloc always moves the block, so every byte is copied each
+// time: 1 + 2 + ... + 200.
+static void test_growth(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_GROWTH='&1' " WORKLOAD "grow" SQUEEZE,
+        "",
+        "lib211_alloc: 1 realloc sites with growth problems\n"
+        "reallocs moves bytes copied linear regrows overcopied site\n"
+        "200 200 20100 1 0 1 alloc_workload.c (grow)\n",
+        "", 0);
+}
+
+// The stacks must add up to the totals, and the live block's stack
+// must start in the program, not in lib211. Stacks differing only in
+// lib211's frames (as the very first allocation's does, since it goes
+// through the setup path) are one stack.
+static void test_heap_profile(void)
+{
+    CHECK_COMMAND(
+        "RT211_HEAP_PROFILE=build/heap.prof " WORKLOAD "sites && "
+        "head -1 build/heap.prof && "
+        "awk '/^[0-9]+: [0-9]+ \\[/ { n++; io += $1; ib += $2; "
+        "    ao += substr($3, 2); ab += $4 } "
+        "    END { print n, \"stacks:\", io, ib, ao, ab }' build/heap.prof && "
+        "awk 'FNR == NR { if ($2 == \"r-xp\" && $6 ~ /alloc_workload$/) { "
+        "        split($1, r, \"-\"); lo = \"x\" r[1]; hi = \"x\" r[2] } "
+        "        next } "
+        "    /^1: 100 / { x = \"x\" substr($6, 3); "
+        "        print (x >= lo && x < hi ? \"in\" : \"outside\"), \"program\" }' "
+        "    build/heap.prof build/heap.prof",
+        "",
+        "heap profile: 1: 100 [7: 326] @ heapprofile\n"
+        "5 stacks: 1 100 7 326\n"
+        "in program\n",
+        "", 0);
+}
+
+// Snapshots come every 1000 calls by default, and at each new peak.
+static void test_heap_csv(void)
+{
+    CHECK_COMMAND(
+        "RT211_HEAP_CSV='&1' " WORKLOAD "sizes",
+        "",
+        "calls,live_bytes,total_bytes,peak\n"
+        "1,0,0,0\n"
+        "11,5000,5204,1\n"
+        "12,0,5204,0\n",
+        "", 0);
+}
+
+static void test_explore(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_EXPLORE='&1' " WORKLOAD "explore" SQUEEZE
+        " | sed -E 's/process [0-9]+/process P/'",
+        "",
+        "lib211_alloc: explored 3 allocation failures in process P: "
+        "1 exited 0, 1 exited nonzero, 1 crashed\n"
+        "alloc result site\n"
+        "1 exit 1 alloc_workload.c (explore)\n"
+        "2 exit 0 alloc_workload.c (explore)\n"
+        "3 signal 6 (Aborted) alloc_workload.c (explore)\n",
+        "", 0);
+}
+
+// Only the process that opened a report writes it, not its children.
+static void test_report_after_fork(void)
+{
+    CHECK_COMMAND(
+        "RT211_ALLOC_SITES=build/fork-sites.txt RT211_ALLOC_EXPLORE=build/x "
+        WORKLOAD "fork >/dev/null 2>&1 && grep -c site build/fork-sites.txt",
+        "", "1\n", "", 0);
+}
+
+// Runs a workload with guarded blocks and prints its exit status (134
+// for abort), then what it said on stderr, less the shell's report of
+// the abort and with block addresses masked.
+#define GUARDED(ENV, NAME) \
+    "RT211_ALLOC_GUARD=1 " ENV " " WORKLOAD NAME " 2>build/guard.err; " \
+    "echo $?; " \
+    "sed -nE 's/0x[0-9a-f]+/P/; /^(lib211_alloc|returning)/p' build/guard.err"
+
+static void test_guard_overflow(void)
+{
+    CHECK_COMMAND(
+        GUARDED("", "overflow"),
+        "",
+        "134\n"
+        "lib211_alloc: buffer overflow in block P of 10 bytes\n",
+        "", 0);
+}
+
+// The quarantine holds the freed block until exit, which checks it.
+static void test_guard_after_free(void)
+{
+    CHECK_COMMAND(
+        GUARDED("", "after_free"),
+        "",
+        "134\n"
+        "returning\n"
+        "lib211_alloc: write after free in block P of 10 bytes\n",
+        "", 0);
+}
+
+// Too small to hold both blocks, the quarantine evicts and checks the
+// first when the second is freed.
+static void test_guard_quarantine(void)
+{
+    CHECK_COMMAND(
+        GUARDED("RT211_ALLOC_QUARANTINE=64", "after_free"),
+        "",
+        "134\n"
+        "lib211_alloc: write after free in block P of 10 bytes\n",
+        "", 0);
+}
+
+static void test_guard_double_free(void)
+{
+    CHECK_COMMAND(
+        GUARDED("", "double_free"),
+        "",
+        "134\n"
+        "lib211_alloc: double free in block P of 10 bytes\n",
+        "", 0);
+}
+
+// Runs programs that weren't built against lib211 under the preload
+// library, which LD_LIBRARY_PATH finds.
+#define PRELOAD  "LD_PRELOAD=lib211-preload.so "
+
+static void test_preload_aligned(void)
+{
+    CHECK_COMMAND(
+        PRELOAD "RT211_TRACE=build/preload.txt "
+        "build/plain_workload aligned >build/preload.out && "
+        "grep '^aligned_alloc' build/preload.txt" NO_SITES
+        " | diff build/preload.out -",
+        "", "", "", 0);
+}
+
+static void test_preload_system_program(void)
+{
+    CHECK_COMMAND(
+        "printf 'b\\na\\n' | "
+        PRELOAD "RT211_TRACE=build/sort.txt sort && "
+        "grep -q '^malloc' build/sort.txt",
+        "", "a\nb\n", "", 0);
+}
+
+// The preload library's wrappers add frames of lib211's own, which the
+// live block's stack mustn't start with either.
+static void test_preload_heap_profile(void)
+{
+    CHECK_COMMAND(
+        PRELOAD "RT211_HEAP_PROFILE=build/preload.prof "
+        "build/plain_workload live && "
+        "awk 'FNR == NR { if ($2 == \"r-xp\" && $6 ~ /plain_workload$/) { "
+        "        split($1, r, \"-\"); lo = \"x\" r[1]; hi = \"x\" r[2] } "
+        "        next } "
+        "    /^1: 100 / { x = \"x\" substr($6, 3); "
+        "        print (x >= lo && x < hi ? \"in\" : \"outside\"), \"program\" }' "
+        "    build/preload.prof build/preload.prof",
+        "", "in program\n", "", 0);
+}
+
+// The C library leaves slack, which Massif calls extra, beyond the
+// bytes requested. (ASan doesn't.)
+static void test_preload_massif(void)
+{
+    CHECK_COMMAND(
+        PRELOAD "RT211_HEAP_MASSIF=build/massif.txt RT211_HEAP_EVERY=1 "
+        "build/plain_workload heap && "
+        "grep -B3 heap_tree=peak build/massif.txt"
+        " | sed -E 's/extra_B=[1-9][0-9]*/extra_B=S/'",
+        "",
+        "mem_heap_B=100\n"
+        "mem_heap_extra_B=S\n"
+        "mem_stacks_B=0\n"
+        "heap_tree=peak\n",
+        "", 0);
+}
+
+int main(void)
+{
+    RUN_TEST( test_text_trace );
+    RUN_TEST( test_binary_trace );
+    RUN_TEST( test_async_trace_fork );
+    RUN_TEST( test_trace_fork_thread );
+    RUN_TEST( test_binary_trace_fork );
+    RUN_TEST( test_trace_merge );
+    RUN_TEST( test_async_trace_run_test );
+    RUN_TEST( test_trace_ops );
+    RUN_TEST( test_trace_every );
+    RUN_TEST( test_trace_sample_bytes );
+    RUN_TEST( test_replay_peak_limit );
+    RUN_TEST( test_replay_total_limit );
+    RUN_TEST( test_replay_repeat );
+    RUN_TEST( test_replay_library );
+    RUN_TEST( test_replay_usage );
+    RUN_TEST( test_sites );
+    RUN_TEST( test_leaks );
+    RUN_TEST( test_histogram );
+    RUN_TEST( test_growth );
+    RUN_TEST( test_heap_profile );
+    RUN_TEST( test_heap_csv );
+    RUN_TEST( test_explore );
+    RUN_TEST( test_report_after_fork );
+    RUN_TEST( test_guard_overflow );
+    RUN_TEST( test_guard_after_free );
+    RUN_TEST( test_guard_quarantine );
+    RUN_TEST( test_guard_double_free );
+    RUN_TEST( test_preload_aligned );
+    RUN_TEST( test_preload_system_program );
+    RUN_TEST( test_preload_massif );
+    RUN_TEST( test_preload_heap_profile );
+}
@@ -4,9 +4,11 @@
 
 #include <211.h>
 #include <211_alloc_limit.h>
+#include <211_alloc_stats.h>
 
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -76,6 +78,61 @@ static void test_limit_peak(void)
     free_all(r);
 }
 
+static void test_limit_peak_realloc(void)
+{
+    alloc_limit_set_peak(100);
+
+    void* p = malloc(10);
+    void* q = malloc(10);
+    CHECK( p && q );
+
+    // Growing past `q` probably moves `p`, which must still be tracked:
+    CHECK( (p = realloc(p, 60)) );
+    CHECK_POINTER( malloc(31), NULL );
+
+    free(p);
+    free(q);
+
+    CHECK( (p = malloc(100)) );
+    free(p);
+}
+
+static void* churn_thread(void* arg)
+{
+    (void) arg;
+
+    void* blocks[16];
+
+    for (size_t round = 0; round < 1000; ++round) {
+        for (size_t i = 0; i < ARRAY_LEN(blocks); ++i)
+            assert( (blocks[i] = malloc(64)) );
+        for (size_t i = 0; i < ARRAY_LEN(blocks); ++i)
+            free(blocks[i]);
+    }
+
+    return NULL;
+}
+
+static void test_limit_peak_threads(void)
+{
+    size_t const limit = 1 << 20;
+    pthread_t threads[8];
+
+    alloc_limit_set_peak(limit);
+
+    for (size_t i = 0; i < ARRAY_LEN(threads); ++i)
+        pthread_create(&threads[i], NULL, &churn_thread, NULL);
+
+    for (size_t i = 0; i < ARRAY_LEN(threads); ++i)
+        pthread_join(threads[i], NULL);
+
+    // Exiting threads must give back any budget they were holding:
+    void* p = malloc(limit);
+    CHECK( p );
+    CHECK_POINTER( malloc(1), NULL );
+    free(p);
+}
+
 static void test_reset_limit(void)
 {
     test_limit_total();
@@ -86,6 +143,125 @@ static void test_reset_limit(void)
     test_limit_peak();
 }
 
+// Setting and lifting the limit swaps the allocation functions. Blocks
+// from one set must be freed properly by the other: those allocated
+// without a limit mustn't be credited to one set later, and the
+// statistics must come out even.
+static void test_limit_switch(void)
+{
+    struct alloc_stats before, after;
+
+    alloc_limit_set_no_limit();
+    alloc_stats_get(&before);
+
+    void* old = malloc(100);
+    CHECK( old );
+
+    alloc_limit_set_peak(10);
+    free(old);
+    void* p = malloc(10);
+    CHECK( p );
+    CHECK_POINTER( malloc(1), NULL );
+
+    alloc_limit_set_no_limit();
+    void* q = malloc(1000);
+    CHECK( q );
+    free(p);
+
+    alloc_limit_set_peak(10);
+    free(q);
+    p = malloc(10);
+    CHECK( p );
+    CHECK_POINTER( malloc(1), NULL );
+    free(p);
+
+    alloc_limit_set_no_limit();
+    alloc_stats_get(&after);
+
+    CHECK_SIZE( after.malloc_calls - before.malloc_calls, 6 );
+    CHECK_SIZE( after.free_calls - before.free_calls, 4 );
+    CHECK_SIZE( after.current_bytes, before.current_bytes );
+}
+
+static void test_limit_nested_peak(void)
+{
+    rec_t r[10];
+    rec_init(r, 10);
+
+    alloc_limit_set_peak(100);
+    malloc_success(r, 50);
+
+    alloc_limit_push(ALLOC_LIMIT_PEAK, 30);
+    malloc_failure(r, 31);
+    malloc_success(r, 20);
+    malloc_failure(r, 11);
+
+    // Only the outer limit paid for this one:
+    free_one(r, 50);
+    malloc_failure(r, 11);
+
+    free_one(r, 20);
+    malloc_success(r, 30);
+    alloc_limit_pop();
+
+    // The block from the inner scope still counts against the outer:
+    malloc_success(r, 70);
+    malloc_failure(r, 1);
+
+    free_all(r);
+}
+
+static void test_limit_nested_total(void)
+{
+    rec_t r[10];
+    rec_init(r, 10);
+
+    alloc_limit_set_no_limit();
+
+    alloc_limit_push(ALLOC_LIMIT_TOTAL, 10);
+    malloc_success(r, 4);
+    free_all(r);
+    malloc_success(r, 6);
+    malloc_failure(r, 1);
+
+    alloc_limit_push(ALLOC_LIMIT_PEAK, 100);
+    malloc_failure(r, 1);
+    alloc_limit_pop();
+    alloc_limit_pop();
+
+    malloc_success(r, 1000);
+    free_all(r);
+}
+
+static void test_limit_nested_realloc(void)
+{
+    alloc_limit_set_peak(100);
+
+    void* p = malloc(40);
+    CHECK( p );
+
+    alloc_limit_push(ALLOC_LIMIT_PEAK, 30);
+
+    // The inner limit never paid for `p`, so it pays only for growth:
+    CHECK_POINTER( realloc(p, 71), NULL );
+    CHECK( (p = realloc(p, 70)) );
+    CHECK_POINTER( malloc(1), NULL );
+
+    // ... and gets nothing back when `p` shrinks, though the outer one
+    // does:
+    CHECK( (p = realloc(p, 40)) );
+    CHECK_POINTER( malloc(1), NULL );
+
+    alloc_limit_pop();
+
+    void* q = malloc(60);
+    CHECK( q );
+    CHECK_POINTER( malloc(1), NULL );
+
+    free(p);
+    free(q);
+}
+
 static void test_env_var_helper(
         const char* total_limit,
         const char* peak_limit,
@@ -178,7 +354,13 @@ int main(void)
     RUN_TEST( test_no_init );
     RUN_TEST( test_limit_total );
     RUN_TEST( test_limit_peak );
+    RUN_TEST( test_limit_peak_realloc );
+    RUN_TEST( test_limit_peak_threads );
     RUN_TEST( test_reset_limit );
+    RUN_TEST( test_limit_switch );
+    RUN_TEST( test_limit_nested_peak );
+    RUN_TEST( test_limit_nested_total );
+    RUN_TEST( test_limit_nested_realloc );
     RUN_TEST( test_stressful );
     RUN_TEST( test_env_limit_total_bytes );
     RUN_TEST( test_env_limit_total_megabytes );
@@ -0,0 +1,96 @@
+// Built with -DLIB211_ALLOC_MODE=stats (see the Makefile), so the
+// allocation functions here only count.
+
+#define _XOPEN_SOURCE 700
+#define LIB211_ALLOC_POSIX
+
+#include <211.h>
+#include <211_alloc_limit.h>
+#include <211_alloc_stats.h>
+
+static struct alloc_stats before, after;
+
+static void start(void)
+{
+    alloc_stats_get(&before);
+}
+
+static void stop(void)
+{
+    alloc_stats_get(&after);
+}
+
+static void test_counts(void)
+{
+    start();
+    char* p = malloc(100);
+    char* q = calloc(10, 20);
+    CHECK( p && q );
+    CHECK( (p = realloc(p, 1000)) );
+    stop();
+
+    CHECK_SIZE( after.malloc_calls - before.malloc_calls, 1 );
+    CHECK_SIZE( after.calloc_calls - before.calloc_calls, 1 );
+    CHECK_SIZE( after.realloc_calls - before.realloc_calls, 1 );
+    CHECK( after.current_bytes - before.current_bytes >= 1200 );
+    CHECK( after.total_bytes - before.total_bytes >= 1300 );
+    CHECK( after.peak_bytes >= after.current_bytes );
+
+    start();
+    free(p);
+    free(q);
+    free(NULL);
+    stop();
+
+    CHECK_SIZE( after.free_calls - before.free_calls, 2 );
+    CHECK( before.current_bytes - after.current_bytes >= 1200 );
+}
+
+static void test_strings(void)
+{
+    start();
+    char* s = strdup("hello");
+    CHECK_STRING( s, "hello" );
+    stop();
+
+    CHECK_SIZE( after.malloc_calls - before.malloc_calls, 1 );
+    CHECK( after.current_bytes - before.current_bytes >= 6 );
+
+    FILE* f = tmpfile();
+    CHECK( f );
+    fputs("a line\n", f);
+    rewind(f);
+
+    char*  line = NULL;
+    size_t size = 0;
+
+    start();
+    CHECK_INT( getline(&line, &size, f), 7 );
+    stop();
+
+    CHECK_STRING( line, "a line\n" );
+    CHECK_SIZE( after.realloc_calls - before.realloc_calls, 1 );
+    CHECK( after.current_bytes - before.current_bytes >= 8 );
+
+    free(line);
+    free(s);
+    fclose(f);
+}
+
+static void test_no_limit(void)
+{
+    alloc_limit_set_peak(10);
+
+    void* p = malloc(100);
+    CHECK( p );
+    free(p);
+
+    alloc_limit_set_no_limit();
+}
+
+int main(void)
+{
+    RUN_TEST( test_counts );
+    RUN_TEST( test_strings );
+    RUN_TEST( test_no_limit );
+}
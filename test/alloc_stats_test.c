@@ -0,0 +1,209 @@
+#include <211.h>
+#include <211_alloc_stats.h>
+
+#include <string.h>
+
+static struct alloc_stats before, after;
+
+static void start(void)
+{
+    alloc_stats_get(&before);
+}
+
+static void stop(void)
+{
+    alloc_stats_get(&after);
+}
+
+static void test_malloc_free(void)
+{
+    start();
+    void* p = malloc(100);
+    void* q = calloc(10, 20);
+    CHECK( p && q );
+    stop();
+
+    CHECK_SIZE( after.malloc_calls - before.malloc_calls, 1 );
+    CHECK_SIZE( after.calloc_calls - before.calloc_calls, 1 );
+    CHECK( after.current_bytes - before.current_bytes >= 300 );
+    CHECK( after.total_bytes - before.total_bytes >= 300 );
+    CHECK( after.peak_bytes >= after.current_bytes );
+
+    start();
+    free(p);
+    free(q);
+    free(NULL);
+    stop();
+
+    CHECK_SIZE( after.free_calls - before.free_calls, 2 );
+    CHECK( before.current_bytes - after.current_bytes >= 300 );
+    CHECK_SIZE( after.total_bytes, before.total_bytes );
+    CHECK_SIZE( after.peak_bytes, before.peak_bytes );
+}
+
+static void test_realloc(void)
+{
+    start();
+    char* p = realloc(NULL, 10);
+    CHECK( p );
+    p = realloc(p, 1000);
+    CHECK( p );
+    stop();
+
+    CHECK_SIZE( after.realloc_calls - before.realloc_calls, 2 );
+    CHECK( after.current_bytes - before.current_bytes >= 1000 );
+    CHECK( after.current_bytes - before.current_bytes < 1100 );
+    CHECK( after.total_bytes - before.total_bytes >= 1010 );
+
+    start();
+    free(p);
+    stop();
+
+    CHECK( before.current_bytes - after.current_bytes >= 1000 );
+}
+
+// Sizes are counted as requested, so header mode and table mode agree.
+static void test_requested_sizes(void)
+{
+    start();
+    char* p = malloc(100);
+    char* q = calloc(3, 7);
+    CHECK( p && q );
+    p = realloc(p, 250);
+    CHECK( p );
+    stop();
+
+    CHECK_SIZE( after.current_bytes - before.current_bytes, 271 );
+    CHECK_SIZE( after.total_bytes - before.total_bytes, 371 );
+
+    start();
+    free(p);
+    free(q);
+    stop();
+
+    CHECK_SIZE( before.current_bytes - after.current_bytes, 271 );
+}
+
+static void test_peak(void)
+{
+    start();
+    void* p = malloc(1 << 20);
+    CHECK( p );
+    free(p);
+    stop();
+
+    CHECK( after.peak_bytes >= before.current_bytes + (1 << 20) );
+    CHECK( after.current_bytes < after.peak_bytes );
+}
+
+static void test_profile_off(void)
+{
+    // RT211_HEAP_PROFILE isn't set.
+    CHECK( !alloc_profile_write(stdout) );
+}
+
+static void test_budgets(void)
+{
+    void* p = NULL;
+
+    CHECK_MAX_ALLOCS( 1, p = malloc(100) );
+    CHECK( p );
+    CHECK_MAX_PEAK_BYTES( 0, free(p) );
+
+    CHECK_MAX_PEAK_BYTES( 200, {
+        free(malloc(100));
+        free(malloc(100));
+    } );
+
+    ASSERT_NO_ALLOC {
+        CHECK_SIZE( strlen("hello"), 5 );
+    }
+}
+
+// Budgets count the sizes requested, even where the C library rounds
+// them up, so they can be exact.
+static void test_exact_budget(void)
+{
+    CHECK_MAX_PEAK_BYTES( 100, free(malloc(100)) );
+    CHECK_MAX_PEAK_BYTES( 300, free(calloc(3, 100)) );
+
+    void* p = malloc(100);
+    CHECK( p );
+    CHECK_MAX_PEAK_BYTES( 150, p = realloc(p, 250) );
+    CHECK( p );
+    free(p);
+}
+
+static void test_nested_budgets(void)
+{
+    start();
+
+    CHECK_MAX_PEAK_BYTES( 1200, {
+        free(malloc(1000));
+        CHECK_MAX_PEAK_BYTES( 200, free(malloc(100)) );
+    } );
+
+    stop();
+
+    // The inner budget mustn't hide the outer one's peak:
+    CHECK( after.peak_bytes >= before.current_bytes + 1000 );
+}
+
+// Writes the diff between `a` and `b` to `buf`.
+static void diff(alloc_snapshot_t const* a, alloc_snapshot_t const* b,
+                 char* buf, size_t size)
+{
+    FILE* f = tmpfile();
+    CHECK( f );
+    CHECK( alloc_snapshot_diff(a, b, f) );
+    rewind(f);
+
+    size_t len = fread(buf, 1, size - 1, f);
+    buf[len] = 0;
+    fclose(f);
+}
+
+static void test_snapshots(void)
+{
+    char buf[4096];
+
+    alloc_snapshot_t* a = alloc_snapshot_take();
+    CHECK( a );
+    void* p = malloc(100);
+    void* q = malloc(200);
+    alloc_snapshot_t* b = alloc_snapshot_take();
+    CHECK( b );
+    void* r = malloc(300);
+    free(q);
+
+    diff(a, b, buf, sizeof buf);
+    CHECK( strstr(buf, " 100 bytes in 1 blocks from then are still live") );
+    CHECK( strstr(buf, "alloc_stats_test.c") );
+
+    // Order doesn't matter, and NULL means now:
+    diff(b, a, buf, sizeof buf);
+    CHECK( strstr(buf, " 100 bytes in 1 blocks from then are still live") );
+    diff(a, NULL, buf, sizeof buf);
+    CHECK( strstr(buf, " 400 bytes in 2 blocks from then are still live") );
+
+    free(p);
+    free(r);
+    diff(a, NULL, buf, sizeof buf);
+    CHECK( strstr(buf, " 0 bytes in 0 blocks from then are still live") );
+
+    alloc_snapshot_free(a);
+    alloc_snapshot_free(b);
+}
+
+int main(void)
+{
+    RUN_TEST( test_malloc_free );
+    RUN_TEST( test_realloc );
+    RUN_TEST( test_requested_sizes );
+    RUN_TEST( test_peak );
+    RUN_TEST( test_profile_off );
+    RUN_TEST( test_budgets );
+    RUN_TEST( test_exact_budget );
+    RUN_TEST( test_nested_budgets );
+    RUN_TEST( test_snapshots );
+}
@@ -0,0 +1,82 @@
+// Tests the live-allocation table from src/ directly, with made-up
+// pointers, so that we can control how often addresses are reused.
+
+#include "alloc_table.h"
+
+#include <lib211_test.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define POOL_SIZE  4096
+
+static void* fake_pointer(size_t k)
+{
+    return (void*) (uintptr_t) (16 * (k + 1));
+}
+
+// Checks that exactly the blocks marked in `live` are in `table`.
+static bool all_live_found(struct alloc_table* table, bool const* live)
+{
+    for (size_t k = 0; k < POOL_SIZE; ++k) {
+        struct alloc_record* rec = alloc_table_find(table, fake_pointer(k));
+
+        if (live[k] ? !rec || rec->size != k : rec != NULL)
+            return false;
+    }
+
+    return true;
+}
+
+static void count_record(struct alloc_record const* rec, void* aux)
+{
+    (void) rec;
+    ++*(size_t*) aux;
+}
+
+// Freed addresses come back while the table is resizing, which mustn't
+// lose any of the entries that haven't been migrated yet.
+static void test_reuse_during_resize(void)
+{
+    struct alloc_table table = ALLOC_TABLE_INIT;
+    bool live[POOL_SIZE] = { false };
+    size_t nlive = 0;
+    bool ok = true;
+
+    srand(211);
+
+    for (size_t step = 0; ok && step < 200000; ++step) {
+        // Grow to the whole pool and shrink back, over and over.
+        bool grow = step / 20000 % 2 == 0;
+        size_t k  = (size_t) rand() % POOL_SIZE;
+        struct alloc_record out;
+
+        if (live[k] && (!grow || rand() % 4 == 0)) {
+            ok = alloc_table_remove(&table, fake_pointer(k), &out) &&
+                 out.size == k;
+            live[k] = false;
+            --nlive;
+        } else if (!live[k]) {
+            struct alloc_record rec = { .pointer = fake_pointer(k), .size = k };
+            ok = alloc_table_insert(&table, &rec);
+            live[k] = true;
+            ++nlive;
+        }
+
+        if (step % 997 == 0) ok = ok && all_live_found(&table, live);
+    }
+
+    CHECK( ok );
+    CHECK( all_live_found(&table, live) );
+
+    size_t count = 0;
+    alloc_table_for_each(&table, &count_record, &count);
+    CHECK_SIZE( count, nlive );
+
+    alloc_table_clear(&table);
+}
+
+int main(void)
+{
+    RUN_TEST( test_reuse_during_resize );
+}
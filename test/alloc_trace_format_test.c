@@ -0,0 +1,126 @@
+// Tests the binary trace encoding from src/alloc_trace_format.h by
+// round-tripping records, especially the delta and varint edge cases.
+
+#include "alloc_trace_format.h"
+
+#include <lib211_test.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ARRAY_LEN(A)   (sizeof(A) / sizeof((A)[0]))
+
+static struct trace_record const records[] = {
+    { .op = TRACE_MALLOC, .thread = 1, .time_ns = 1000,
+      .size = 0, .out_ptr = 0x1000 },
+    // The limit refused SIZE_MAX bytes, so the pointer goes back to 0:
+    { .op = TRACE_MALLOC, .flags = TRACE_DENIED, .thread = 1,
+      .time_ns = 1001, .size = SIZE_MAX, .out_ptr = 0,
+      .denied = SIZE_MAX, .remaining = 0 },
+    // Pointer deltas as large as they get, both ways:
+    { .op = TRACE_CALLOC, .thread = 2, .time_ns = 1002,
+      .count = UINT64_MAX, .size = 1, .out_ptr = UINT64_C(1) << 63 },
+    { .op = TRACE_REALLOC, .thread = 2, .time_ns = 1003, .size = 7,
+      .in_ptr = UINT64_MAX, .out_ptr = 0 },
+    { .op = TRACE_REALLOCF, .thread = 3, .time_ns = 1004, .size = 0,
+      .in_ptr = 0x1000, .out_ptr = 0xff0 },
+    // Time may go backward between threads:
+    { .op = TRACE_FREE, .thread = 4, .time_ns = 5, .in_ptr = 0x10 },
+    { .op = TRACE_MEMALIGN, .thread = UINT32_MAX, .time_ns = UINT64_MAX,
+      .count = 4096, .size = SIZE_MAX, .out_ptr = 0x2000 },
+    { .op = TRACE_FREE, .flags = TRACE_SAMPLED, .thread = 1, .time_ns = 0,
+      .in_ptr = 0x2000, .weight = 12.5 },
+    { .op = TRACE_MALLOC, .thread = 1, .time_ns = 7, .size = 24,
+      .out_ptr = 0x3000, .site = 300, .line = 42,
+      .file = "main.c", .func = "main" },
+    // The same site again, which mustn't be redefined:
+    { .op = TRACE_MALLOC, .thread = 1, .time_ns = 8, .size = 24,
+      .out_ptr = 0x3020, .site = 300, .line = 42,
+      .file = "main.c", .func = "main" },
+};
+
+static bool same_string(char const* a, char const* b)
+{
+    return a && b ? !strcmp(a, b) : a == b;
+}
+
+static bool same_record(struct trace_record const* a,
+                        struct trace_record const* b)
+{
+    bool counted = a->op == TRACE_CALLOC || a->op == TRACE_MEMALIGN;
+    bool denied  = a->flags & TRACE_DENIED;
+
+    return a->op == b->op && a->flags == b->flags &&
+           a->thread == b->thread && a->time_ns == b->time_ns &&
+           (counted ? a->count == b->count : b->count == 1) &&
+           (a->op == TRACE_FREE || a->size == b->size) &&
+           a->in_ptr == b->in_ptr && a->out_ptr == b->out_ptr &&
+           (!denied || (a->denied == b->denied &&
+                        a->remaining == b->remaining)) &&
+           (a->flags & TRACE_SAMPLED ? a->weight == b->weight
+                                     : b->weight == 1) &&
+           a->site == b->site && a->line == b->line &&
+           same_string(a->file, b->file) && same_string(a->func, b->func);
+}
+
+static void test_round_trip(void)
+{
+    FILE* f = tmpfile();
+    CHECK( f );
+
+    struct trace_codec encoder = { .time_ns = 500 };
+    for (size_t i = 0; i < ARRAY_LEN(records); ++i)
+        trace_write(&encoder, &records[i], f);
+    trace_codec_destroy(&encoder);
+
+    rewind(f);
+
+    struct trace_codec  decoder = { .time_ns = 500 };
+    struct trace_record rec;
+
+    for (size_t i = 0; i < ARRAY_LEN(records); ++i) {
+        CHECK( trace_decode(&decoder, f, &rec) );
+        if (!CHECK( same_record(&records[i], &rec) ))
+            fprintf(stderr, "  (record %zu)\n", i);
+    }
+
+    CHECK( !trace_decode(&decoder, f, &rec) );
+    CHECK( feof(f) );
+
+    trace_codec_destroy(&decoder);
+    fclose(f);
+}
+
+static void test_truncated(void)
+{
+    FILE* f = tmpfile();
+    CHECK( f );
+
+    struct trace_codec encoder = { .time_ns = 0 };
+    trace_write(&encoder, &records[2], f);
+    trace_codec_destroy(&encoder);
+
+    // Chop off the last byte of the pointer.
+    long len = ftell(f);
+    rewind(f);
+    char buf[TRACE_RECORD_MAX];
+    CHECK( fread(buf, 1, (size_t) len, f) == (size_t) len );
+    fclose(f);
+
+    f = tmpfile();
+    fwrite(buf, 1, (size_t) len - 1, f);
+    rewind(f);
+
+    struct trace_codec  decoder = { .time_ns = 0 };
+    struct trace_record rec;
+    CHECK( !trace_decode(&decoder, f, &rec) );
+
+    trace_codec_destroy(&decoder);
+    fclose(f);
+}
+
+int main(void)
+{
+    RUN_TEST( test_round_trip );
+    RUN_TEST( test_truncated );
+}
@@ -0,0 +1,283 @@
+// A program for alloc_env_test to run under the RT211_* environment
+// variables. Each workload, named by the first argument, makes some
+// allocation calls and prints what it expects to see about them.
+//
+// Usage: alloc_workload WORKLOAD
+
+#define _XOPEN_SOURCE 700
+
+#include <211.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+// Each call prints itself to `expected` the way the text trace shows it.
+static FILE* expected;
+
+static void* traced_malloc(size_t size)
+{
+    void* p = malloc(size);
+    fprintf(expected, "malloc(%zu) = %p\n", size, p);
+    return p;
+}
+
+static void* traced_calloc(size_t count, size_t size)
+{
+    void* p = calloc(count, size);
+    fprintf(expected, "calloc(%zu, %zu) = %p\n", count, size, p);
+    return p;
+}
+
+static void* traced_realloc(void* p, size_t size)
+{
+    void* q = realloc(p, size);
+    fprintf(expected, "realloc(%p, %zu) = %p\n", p, size, q);
+    return q;
+}
+
+static void* traced_aligned(size_t align, size_t size)
+{
+    void* p = aligned_alloc(align, size);
+    fprintf(expected, "aligned_alloc(%zu, %zu) = %p\n", align, size, p);
+    return p;
+}
+
+static void traced_free(void* p)
+{
+    free(p);
+    fprintf(expected, "free(%p)\n", p);
+}
+
+// One of each call, with sizes and pointers at the edges of what the
+// binary format has to encode.
+static int trace(void)
+{
+    void* a = traced_malloc(0);
+    void* b = traced_malloc(100);
+    traced_malloc(SIZE_MAX);                // fails
+    void* c = traced_calloc(3, 5);
+    b = traced_realloc(b, 1000);
+    void* d = traced_aligned(64, 128);
+    traced_free(a);                         // pointer goes down
+    traced_free(NULL);
+    traced_free(d);
+    traced_free(c);
+    traced_free(b);
+    return 0;
+}
+
+// Allocates in a child process as well as the parent. The child's
+// calls go to stderr.
+static int fork_child(void)
+{
+    traced_free(traced_malloc(1));
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) return 1;
+
+    if (pid == 0) {
+        expected = stderr;
+        traced_free(traced_malloc(2));
+        traced_free(traced_calloc(2, 2));
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || status != 0) return 1;
+
+    traced_free(traced_malloc(3));
+    return 0;
+}
+
+static void* traced_in_thread(void* unused)
+{
+    (void) unused;
+    traced_free(traced_malloc(4));
+    return NULL;
+}
+
+// Like `fork_child`, but with no threads in the parent, and the child
+// allocates from a new thread.
+static int fork_thread(void)
+{
+    traced_free(traced_malloc(1));
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) return 1;
+
+    if (pid == 0) {
+        expected = stderr;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &traced_in_thread, NULL) ||
+                pthread_join(thread, NULL))
+            exit(1);
+
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || status != 0) return 1;
+
+    traced_free(traced_malloc(3));
+    return 0;
+}
+
+static void small_blocks(void)
+{
+    for (int i = 0; i < 3; ++i)
+        free(malloc(10));
+}
+
+static void* big_block(void)
+{
+    return malloc(100);
+}
+
+// Allocates from a few call sites, leaving one block live at exit.
+// The expected per-site statistics are in alloc_env_test.
+static int sites(void)
+{
+    small_blocks();
+    free(big_block());
+    big_block();
+
+    free(rt211_malloc_at(64, "made_up.c", 7, "made_up"));
+
+    // Through a function pointer, the site is unknown.
+    void* (*alloc)(size_t) = &rt211_malloc;
+    free(alloc(32));
+
+    return 0;
+}
+
+// Requests a spread of sizes.
+static int sizes(void)
+{
+    size_t const sizes[] = { 0, 1, 3, 100, 100, 5000 };
+
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+        free(malloc(sizes[i]));
+
+    return 0;
+}
+
+// Handles running out of memory at the first allocation by failing,
+// at the second by carrying on, and at the third not at all.
+static int explore(void)
+{
+    char* a = malloc(10);
+    if (!a) return 1;
+
+    char* b = malloc(20);
+    if (!b) {
+        free(a);
+        return 0;
+    }
+
+    char* c = malloc(30);
+    if (!c) abort();
+
+    free(a);
+    free(b);
+    free(c);
+    return 0;
+}
+
+// Grows one block a byte at a time.
+static int grow(void)
+{
+    char* p = malloc(1);
+
+    for (size_t n = 2; n <= 201; ++n) {
+        char* q = realloc(p, n);
+        if (!q) return 1;
+        p = q;
+    }
+
+    free(p);
+    return 0;
+}
+
+// Lots of small blocks, for sampling.
+static int many(void)
+{
+    for (int i = 0; i < 20000; ++i)
+        free(malloc(100));
+
+    return 0;
+}
+
+// The guard workloads launder their pointers through this so the
+// compiler can't see the bugs they're there to make.
+static char* volatile launder;
+
+// Writes one byte past the end of a block.
+static int overflow(void)
+{
+    launder = malloc(10);
+    launder[10] = 'x';
+    free(launder);
+    return 0;
+}
+
+// Writes to a block in quarantine, then frees a second block, which
+// evicts the first if the quarantine can't hold both.
+static int after_free(void)
+{
+    launder = malloc(10);
+    free(launder);
+    launder[0] = 'x';
+
+    free(malloc(60));
+    fprintf(stderr, "returning\n");
+    return 0;
+}
+
+static int double_free(void)
+{
+    launder = malloc(10);
+    free(launder);
+    free(launder);
+    return 0;
+}
+
+static struct
+{
+    char const* name;
+    int (*run)(void);
+} const workloads[] = {
+    { "trace", &trace },
+    { "fork",  &fork_child },
+    { "fork_thread", &fork_thread },
+    { "sites", &sites },
+    { "sizes", &sizes },
+    { "explore", &explore },
+    { "grow",  &grow },
+    { "many",  &many },
+    { "overflow", &overflow },
+    { "after_free", &after_free },
+    { "double_free", &double_free },
+};
+
+int main(int argc, char* argv[])
+{
+    expected = stdout;
+
+    if (argc == 2) {
+        for (size_t i = 0; i < sizeof workloads / sizeof *workloads; ++i)
+            if (!strcmp(argv[1], workloads[i].name))
+                return workloads[i].run();
+    }
+
+    fprintf(stderr, "Usage: alloc_workload WORKLOAD\n");
+    return 2;
+}
@@ -0,0 +1,138 @@
+#define LIB211_ALLOC_POSIX
+
+#include <211.h>
+#include <211_alloc_limit.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static void test_aligned_alloc(void)
+{
+    alloc_limit_set_no_limit();
+
+    for (size_t align = 1; align <= 4096; align *= 4) {
+        char* p = aligned_alloc(align, 100);
+        CHECK( p );
+        CHECK_SIZE( (uintptr_t) p % align, 0 );
+        p[0] = p[99] = 'x';
+
+        // It may move, but it must survive:
+        CHECK( (p = realloc(p, 200)) );
+        CHECK_CHAR( p[99], 'x' );
+        free(p);
+    }
+
+    errno = 0;
+    CHECK_POINTER( aligned_alloc(3, 100), NULL );
+    CHECK_INT( errno, EINVAL );
+}
+
+static void test_aligned_alloc_limit(void)
+{
+    alloc_limit_set_peak(1000);
+
+    void* p = aligned_alloc(256, 600);
+    CHECK( p );
+    CHECK_POINTER( aligned_alloc(256, 401), NULL );
+
+    // Freeing it must give back the whole 600 bytes:
+    free(p);
+    CHECK( (p = aligned_alloc(64, 1000)) );
+    free(p);
+
+    alloc_limit_set_no_limit();
+}
+
+static void test_posix_memalign(void)
+{
+    void* p = NULL;
+
+    CHECK_INT( posix_memalign(&p, 3, 100), EINVAL );
+    CHECK_INT( posix_memalign(&p, 24, 100), EINVAL );
+    CHECK_POINTER( p, NULL );
+
+    CHECK_INT( posix_memalign(&p, 128, 100), 0 );
+    CHECK( p );
+    CHECK_SIZE( (uintptr_t) p % 128, 0 );
+
+    alloc_limit_set_total(100);
+    void* q = NULL;
+    CHECK_INT( posix_memalign(&q, 128, 101), ENOMEM );
+    CHECK_POINTER( q, NULL );
+    alloc_limit_set_no_limit();
+
+    free(p);
+}
+
+static void test_strdup(void)
+{
+    alloc_limit_set_peak(6);
+
+    char* s = strdup("hello");
+    CHECK_STRING( s, "hello" );
+    CHECK_POINTER( strdup("a"), NULL );
+    free(s);
+
+    char* t = strndup("hello, world", 5);
+    CHECK_STRING( t, "hello" );
+    free(t);
+
+    CHECK_POINTER( strndup("hello, world", 6), NULL );
+
+    alloc_limit_set_no_limit();
+}
+
+static void test_getline(void)
+{
+    FILE* f = tmpfile();
+    CHECK( f );
+    fputs("one\ntwo two\n\nlast", f);
+    rewind(f);
+
+    char*  line = NULL;
+    size_t size = 0;
+
+    CHECK_INT( getline(&line, &size, f), 4 );
+    CHECK_STRING( line, "one\n" );
+    CHECK_INT( getline(&line, &size, f), 8 );
+    CHECK_STRING( line, "two two\n" );
+    CHECK_INT( getline(&line, &size, f), 1 );
+    CHECK_STRING( line, "\n" );
+    CHECK_INT( getdelim(&line, &size, 'x', f), 4 );
+    CHECK_STRING( line, "last" );
+    CHECK_INT( getline(&line, &size, f), -1 );
+
+    free(line);
+    fclose(f);
+}
+
+static void test_getline_limit(void)
+{
+    FILE* f = tmpfile();
+    CHECK( f );
+    for (int i = 0; i < 1000; ++i) fputc('x', f);
+    rewind(f);
+
+    char*  line = NULL;
+    size_t size = 0;
+
+    alloc_limit_set_peak(500);
+    errno = 0;
+    CHECK_INT( getline(&line, &size, f), -1 );
+    CHECK_INT( errno, ENOMEM );
+    alloc_limit_set_no_limit();
+
+    free(line);
+    fclose(f);
+}
+
+int main(void)
+{
+    RUN_TEST( test_aligned_alloc );
+    RUN_TEST( test_aligned_alloc_limit );
+    RUN_TEST( test_posix_memalign );
+    RUN_TEST( test_strdup );
+    RUN_TEST( test_getline );
+    RUN_TEST( test_getline_limit );
+}
@@ -0,0 +1,80 @@
+#include <211.h>
+#include <211_alloc_limit.h>
+#include <211_arena.h>
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+static void test_alloc(void)
+{
+    struct lib211_arena* arena = lib211_arena_create(256);
+    CHECK( arena );
+
+    char* p = lib211_arena_alloc(arena, 1);
+    char* q = lib211_arena_alloc(arena, 100);
+    CHECK( p && q );
+    CHECK( p != q );
+    CHECK_SIZE( (uintptr_t) q % alignof(max_align_t), 0 );
+
+    // Bigger than a chunk:
+    char* big = lib211_arena_alloc(arena, 10000);
+    CHECK( big );
+    memset(big, 'x', 10000);
+    memset(q, 'y', 100);
+    CHECK_CHAR( big[9999], 'x' );
+
+    lib211_arena_destroy(arena);
+}
+
+static void test_mark_reset(void)
+{
+    struct lib211_arena* arena = lib211_arena_create(128);
+    CHECK( arena );
+
+    void* before = lib211_arena_alloc(arena, 16);
+    struct lib211_arena_mark mark = lib211_arena_mark(arena);
+
+    void* first = lib211_arena_alloc(arena, 16);
+    for (int i = 0; i < 100; ++i)
+        CHECK( lib211_arena_alloc(arena, 48) );
+
+    lib211_arena_reset(arena, mark);
+
+    // We get the same memory back, and what came before is untouched:
+    CHECK_POINTER( lib211_arena_alloc(arena, 16), first );
+    CHECK( before != first );
+
+    lib211_arena_destroy(arena);
+}
+
+static void test_limit(void)
+{
+    alloc_limit_set_peak(4096);
+
+    struct lib211_arena* arena = lib211_arena_create(1024);
+    CHECK( arena );
+
+    // Chunks count against the limit, so this can't last:
+    size_t n = 0;
+    while (lib211_arena_alloc(arena, 100)) ++n;
+    CHECK( n > 10 );
+    CHECK( n < 40 );
+
+    // Resetting gives the chunks back:
+    lib211_arena_reset(arena, (struct lib211_arena_mark) { NULL, 0 });
+    CHECK( lib211_arena_alloc(arena, 100) );
+
+    lib211_arena_destroy(arena);
+
+    void* p = malloc(4096);
+    CHECK( p );
+    free(p);
+}
+
+int main(void)
+{
+    RUN_TEST( test_alloc );
+    RUN_TEST( test_mark_reset );
+    RUN_TEST( test_limit );
+}
@@ -88,6 +88,12 @@ static void test_env_alloc_limit_peak_50_GB(void)
     test_env_exit_code("RT211_ALLOC_LIMIT_PEAK=50G", 0);
 }
 
+// Guarding every block mustn't change anything for a correct program.
+static void test_env_alloc_guard(void)
+{
+    test_env_exit_code("RT211_ALLOC_GUARD=1", 0);
+}
+
 int main(void)
 {
     RUN_TEST( test_true_cmd );
@@ -104,4 +110,5 @@ int main(void)
     RUN_TEST( test_env_alloc_limit_total_50_MB );
     RUN_TEST( test_env_alloc_limit_peak_50_MB );
     RUN_TEST( test_env_alloc_limit_peak_50_GB );
+    RUN_TEST( test_env_alloc_guard );
 }
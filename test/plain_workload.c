@@ -0,0 +1,73 @@
+// An ordinary program, not built against lib211, for alloc_env_test to
+// run under lib211-preload.so, where the C library's allocator (unlike
+// ASan's) leaves slack.
+//
+// Usage: plain_workload WORKLOAD
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The preload library traces each of these as aligned_alloc, with the
+// alignment and size it actually asks for.
+static void* expect(void* p, size_t align, size_t size)
+{
+    printf("aligned_alloc(%zu, %zu) = %p\n", align, size, p);
+
+    if (!p || (uintptr_t) p % align || malloc_usable_size(p) < size) {
+        fprintf(stderr, "plain_workload: bad block %p\n", p);
+        exit(1);
+    }
+
+    memset(p, 0, malloc_usable_size(p));
+    return p;
+}
+
+// Calls the allocation functions that only interposition can catch,
+// checks that the blocks are as big and as aligned as promised, and
+// prints the calls the trace should show.
+static int aligned(void)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    // memalign(3) may go below pointer alignment; we round it up.
+    void* a = expect(memalign(4, 10), sizeof(void*), 10);
+    void* b = expect(memalign(64, 100), 64, 100);
+    void* c = expect(valloc(100), page, 100);
+    void* d = expect(pvalloc(1), page, page);
+
+    free(a);
+    free(b);
+    free(c);
+    free(d);
+    return 0;
+}
+
+// One block at a time, without stdio, which would allocate too.
+static int heap(void)
+{
+    free(malloc(10));
+    free(malloc(100));
+    return 0;
+}
+
+// Leaves one block live at exit.
+static int live(void)
+{
+    return malloc(100) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "aligned")) return aligned();
+    if (argc == 2 && !strcmp(argv[1], "heap")) return heap();
+    if (argc == 2 && !strcmp(argv[1], "live")) return live();
+
+    fprintf(stderr, "Usage: plain_workload WORKLOAD\n");
+    return 2;
+}
@@ -0,0 +1,79 @@
+// rt211_trace_decode: converts a binary allocation trace (written with
+// RT211_TRACE_FORMAT=bin) back into the text trace format.
+//
+// Usage: rt211_trace_decode [-v] [FILE]
+//
+// Reads FILE, or standard input if FILE is absent or "-". With -v, each
+// record is prefixed by its thread number and its time in microseconds
+// since the trace started.
+
+#define _XOPEN_SOURCE 700
+
+#include "alloc_trace_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char const* me = "rt211_trace_decode";
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s [-v] [FILE]\n", me);
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') verbose = true;
+        else usage();
+    }
+
+    if (argc - optind > 1) usage();
+
+    char const* path = optind < argc ? argv[optind] : "-";
+    FILE* in = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!in) {
+        perror(path);
+        return 1;
+    }
+
+    struct trace_file_header header;
+    if (fread(&header, sizeof header, 1, in) != 1 ||
+            memcmp(header.magic, TRACE_MAGIC, sizeof header.magic)) {
+        fprintf(stderr, "%s: %s: not a binary rt211 trace\n", me, path);
+        return 1;
+    }
+
+    if (header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: %s: unsupported trace version %" PRIu32 "\n",
+                me, path, header.version);
+        return 1;
+    }
+
+    struct trace_codec codec = { .time_ns = header.start_ns };
+    struct trace_record rec;
+
+    while (trace_decode(&codec, in, &rec)) {
+        if (verbose) {
+            printf("[%" PRIu32 " %.3f] ", rec.thread,
+                   (rec.time_ns - header.start_ns) / 1e3);
+        }
+
+        trace_print_text(stdout, &rec);
+    }
+
+    trace_codec_destroy(&codec);
+
+    if (!feof(in)) {
+        fprintf(stderr, "%s: %s: malformed record\n", me, path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+// rt211_trace_merge: merges the binary allocation traces of a process
+// tree (as written with RT211_TRACE_FORMAT=bin, which gives each process
+// its own file: RT211_TRACE with `%p` expanded, or else with `.PID`
+// appended for forked children) into one text trace, in time order.
+//
+// Usage: rt211_trace_merge FILE...
+//
+// The output starts with the process tree, one comment line per trace
+// file, indented under its parent:
+//
+//     # process 4242 (parent 4200) from 0.000 ms, 1017 calls
+//     #   process 4243 (parent 4242) from 1.250 ms, 12 calls
+//
+// and then each call in the text trace format, prefixed by its process
+// ID, its thread number and its time in microseconds since the first
+// trace started:
+//
+//     [4243 1 1254.113] malloc(16) = 0x55d0c2a3b2a0
+//
+// Pointers are only meaningful within a process, so rt211_trace_replay
+// should be given one process's trace at a time.
+
+#define _XOPEN_SOURCE 700
+
+#include "alloc_trace_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const* me = "rt211_trace_merge";
+
+struct input
+{
+    char const*              path;
+    FILE*                    file;
+    struct trace_file_header header;
+    struct trace_codec       codec;
+    struct trace_record      rec;       // the next record, if `live`
+    bool                     live;
+    size_t                   calls;
+};
+
+static struct input* inputs;
+static size_t        ninputs;       // that we could open
+
+// Indices of the inputs that still have records, as a binary min-heap
+// on the time of each one's next record.
+static size_t* heap;
+static size_t  heap_len;
+
+static bool earlier(size_t a, size_t b)
+{
+    return inputs[a].rec.time_ns < inputs[b].rec.time_ns;
+}
+
+static void sift_down(size_t i)
+{
+    for (;;) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+
+        if (l < heap_len && earlier(heap[l], heap[least])) least = l;
+        if (r < heap_len && earlier(heap[r], heap[least])) least = r;
+        if (least == i) return;
+
+        size_t tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+// Opens `in`, or complains and returns false. (A process that was
+// killed may have left an empty file, which shouldn't stop us.)
+static bool open_input(struct input* in)
+{
+    in->file = fopen(in->path, "rb");
+    if (!in->file) {
+        perror(in->path);
+        return false;
+    }
+
+    if (fread(&in->header, sizeof in->header, 1, in->file) != 1 ||
+            memcmp(in->header.magic, TRACE_MAGIC, sizeof in->header.magic)) {
+        fprintf(stderr, "%s: %s: not a binary rt211 trace\n", me, in->path);
+    } else if (in->header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: %s: unsupported trace version %" PRIu32 "\n",
+                me, in->path, in->header.version);
+    } else {
+        in->codec.time_ns = in->header.start_ns;
+        return true;
+    }
+
+    fclose(in->file);
+    return false;
+}
+
+// Reads `in`'s next record, returning false at the end.
+static bool advance(struct input* in)
+{
+    in->live = trace_decode(&in->codec, in->file, &in->rec);
+
+    if (!in->live && !feof(in->file))
+        fprintf(stderr, "%s: %s: malformed record\n", me, in->path);
+
+    return in->live;
+}
+
+// Counts the calls in `in`, so the tree can say, then starts it over.
+static void count_calls(struct input* in)
+{
+    while (trace_decode(&in->codec, in->file, &in->rec))
+        ++in->calls;
+
+    fseek(in->file, (long) sizeof in->header, SEEK_SET);
+    trace_codec_destroy(&in->codec);
+    in->codec.time_ns = in->header.start_ns;
+}
+
+static uint64_t first_start;
+
+// Prints the processes whose parent is `ppid`, and theirs in turn.
+// Inputs whose parent has no trace are roots, printed with `ppid` 0.
+static void print_tree(uint32_t ppid, int depth, bool* printed)
+{
+    for (size_t i = 0; i < ninputs; ++i) {
+        struct input const* in = &inputs[i];
+        if (printed[i]) continue;
+
+        bool has_parent = false;
+        for (size_t j = 0; j < ninputs; ++j)
+            if (j != i && inputs[j].header.pid == in->header.ppid)
+                has_parent = true;
+
+        if (ppid ? in->header.ppid != ppid : has_parent) continue;
+
+        printed[i] = true;
+        printf("# %*sprocess %" PRIu32 " (parent %" PRIu32 ") "
+               "from %.3f ms, %zu calls\n",
+               2 * depth, "", in->header.pid, in->header.ppid,
+               (in->header.start_ns - first_start) / 1e6, in->calls);
+
+        print_tree(in->header.pid, depth + 1, printed);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE...\n", me);
+        return 2;
+    }
+
+    inputs = calloc((size_t) argc, sizeof *inputs);
+    heap   = calloc((size_t) argc, sizeof *heap);
+    bool* printed = calloc((size_t) argc, sizeof *printed);
+    if (!inputs || !heap || !printed) {
+        perror(me);
+        return 1;
+    }
+
+    int status = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        struct input* in = &inputs[ninputs];
+        in->path = argv[i];
+
+        if (!open_input(in)) {
+            status = 1;
+            continue;
+        }
+
+        count_calls(in);
+
+        if (!ninputs || in->header.start_ns < first_start)
+            first_start = in->header.start_ns;
+
+        ++ninputs;
+    }
+
+    print_tree(0, 0, printed);
+
+    // Cycles of parents (from reused process IDs) are left over.
+    for (size_t i = 0; i < ninputs; ++i)
+        if (!printed[i]) print_tree(inputs[i].header.ppid, 0, printed);
+
+    for (size_t i = 0; i < ninputs; ++i)
+        if (advance(&inputs[i])) heap[heap_len++] = i;
+
+    for (size_t i = heap_len; i-- > 0; )
+        sift_down(i);
+
+    while (heap_len) {
+        struct input* in = &inputs[heap[0]];
+
+        printf("[%" PRIu32 " %" PRIu32 " %.3f] ", in->header.pid,
+               in->rec.thread, (in->rec.time_ns - first_start) / 1e3);
+        trace_print_text(stdout, &in->rec);
+
+        if (!advance(in)) heap[0] = heap[--heap_len];
+        sift_down(0);
+    }
+
+    for (size_t i = 0; i < ninputs; ++i) {
+        if (!feof(inputs[i].file)) status = 1;
+        trace_codec_destroy(&inputs[i].codec);
+        fclose(inputs[i].file);
+    }
+
+    free(inputs);
+    free(heap);
+    free(printed);
+    return status;
+}
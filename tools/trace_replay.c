@@ -0,0 +1,805 @@
+// rt211_trace_replay: re-executes the allocations in a trace (binary, or
+// text with result pointers) to see how they would fare under another
+// allocator or allocation limit, without rerunning the program.
+//
+// Usage: rt211_trace_replay [-r N] [-a LIB.so [-p PREFIX]] [FILE]
+//        rt211_trace_replay {-l | -t} LIMIT [FILE]
+//
+// Reads FILE, or standard input if FILE is absent or "-". By default the
+// calls are made on the C library's allocator; with -a they are made on
+// the one in LIB.so instead, which must define PREFIX`malloc` and
+// PREFIX`free`, and may define PREFIX`calloc`, PREFIX`realloc` and
+// PREFIX`aligned_alloc` (otherwise those are done with the first two).
+// -r repeats the replay N times and reports the fastest and the mean.
+//
+// With -l or -t, nothing is allocated; instead we simulate a peak (-l)
+// or total (-t) allocation limit of LIMIT bytes (which may be followed
+// by K, M or G) and report which calls it would refuse. A refused block
+// is treated as never allocated, so its free is ignored, but the rest of
+// the program is assumed to carry on as it did, which it may not have.
+//
+// Either way we report the calls in the trace and the peak, total and
+// unfreed bytes requested. The replay is single-threaded, in the order
+// the trace recorded calls. A sampled trace replays only the sampled
+// blocks.
+
+#define _XOPEN_SOURCE 700
+
+#include "alloc_trace_format.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char const* me = "rt211_trace_replay";
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: %s [-r N] [-a LIB.so [-p PREFIX]] [FILE]\n"
+            "       %s {-l | -t} LIMIT [FILE]\n", me, me);
+    exit(2);
+}
+
+static _Noreturn void fail(char const* what)
+{
+    fprintf(stderr, "%s: %s\n", me, what);
+    exit(1);
+}
+
+static void* xrealloc(void* p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fail(strerror(errno));
+    return p;
+}
+
+///
+/// LOADING THE TRACE
+///
+
+// Blocks are numbered by "slot," which we hand out when a block is
+// allocated and take back when it's freed, so the replay only needs an
+// array as big as the most blocks live at once.
+#define NO_SLOT  UINT32_MAX
+
+struct step
+{
+    uint8_t  op;
+    uint32_t slot;
+    uint64_t count;     // calloc; for aligned_alloc, the alignment; for
+                        // realloc, the old size
+    uint64_t size;
+};
+
+static struct step* steps      = NULL;
+static size_t       step_count = 0;
+static size_t       step_cap   = 0;
+
+static uint32_t  slot_count = 0;
+static uint32_t* free_slots = NULL;
+static size_t    free_count = 0;
+
+// The size of the block in each slot, as requested.
+static uint64_t* slot_sizes = NULL;
+
+// What the trace says about the program's use of memory.
+static struct
+{
+    size_t   calls[TRACE_MEMALIGN + 1];
+    uint64_t current, peak, total;
+    size_t   unmatched;     // frees and reallocs of unknown pointers
+    size_t   reused;        // results that were still live, by our count
+    bool     sampled;
+} trace;
+
+// Maps pointers in the trace to slots: open addressing with linear
+// probing, and deletion by shifting back later entries in the run.
+struct entry
+{
+    uint64_t pointer;       // 0 if empty
+    uint32_t slot;
+};
+
+static struct entry* table     = NULL;
+static size_t        table_cap = 0;
+static size_t        table_len = 0;
+
+static size_t hash_pointer(uint64_t p)
+{
+    return (size_t) (((p >> 4) * UINT64_C(0x9e3779b97f4a7c15)) >> 20);
+}
+
+static struct entry* find_entry(uint64_t p)
+{
+    size_t mask = table_cap - 1;
+
+    for (size_t i = hash_pointer(p) & mask; ; i = (i + 1) & mask)
+        if (table[i].pointer == p || !table[i].pointer) return &table[i];
+}
+
+static void table_insert(uint64_t p, uint32_t slot);
+
+static void grow_table(void)
+{
+    struct entry* old     = table;
+    size_t        old_cap = table_cap;
+
+    table_cap = old_cap ? 2 * old_cap : 1024;
+    table     = calloc(table_cap, sizeof *table);
+    if (!table) fail(strerror(errno));
+    table_len = 0;
+
+    for (size_t i = 0; i < old_cap; ++i)
+        if (old[i].pointer) table_insert(old[i].pointer, old[i].slot);
+
+    free(old);
+}
+
+static void table_insert(uint64_t p, uint32_t slot)
+{
+    if (2 * (table_len + 1) > table_cap) grow_table();
+
+    struct entry* e = find_entry(p);
+    if (!e->pointer) ++table_len;
+    *e = (struct entry) { p, slot };
+}
+
+static uint32_t table_remove(uint64_t p)
+{
+    if (!p || !table_len) return NO_SLOT;
+
+    struct entry* e = find_entry(p);
+    if (!e->pointer) return NO_SLOT;
+
+    uint32_t slot = e->slot;
+    size_t   mask = table_cap - 1;
+    size_t   hole = (size_t) (e - table);
+
+    for (size_t i = (hole + 1) & mask; table[i].pointer; i = (i + 1) & mask) {
+        size_t home = hash_pointer(table[i].pointer) & mask;
+
+        // Move the entry back into the hole if the hole lies between
+        // its home and where it is now.
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table[hole] = table[i];
+            hole = i;
+        }
+    }
+
+    table[hole].pointer = 0;
+    --table_len;
+    return slot;
+}
+
+static uint32_t take_slot(uint64_t size)
+{
+    uint32_t slot;
+
+    if (free_count) {
+        slot = free_slots[--free_count];
+    } else {
+        slot = slot_count++;
+        free_slots = xrealloc(free_slots, slot_count * sizeof *free_slots);
+        slot_sizes = xrealloc(slot_sizes, slot_count * sizeof *slot_sizes);
+    }
+
+    slot_sizes[slot] = size;
+    trace.current += size;
+    trace.total   += size;
+    if (trace.current > trace.peak) trace.peak = trace.current;
+    return slot;
+}
+
+static void give_back_slot(uint32_t slot)
+{
+    trace.current -= slot_sizes[slot];
+    free_slots[free_count++] = slot;
+}
+
+static void add_step(uint8_t op, uint32_t slot, uint64_t count, uint64_t size)
+{
+    if (step_count == step_cap) {
+        step_cap = step_cap ? 2 * step_cap : 4096;
+        steps    = xrealloc(steps, step_cap * sizeof *steps);
+    }
+
+    steps[step_count++] = (struct step) { op, slot, count, size };
+}
+
+// Turns one call from the trace into a step.
+static void add_call(struct trace_record const* rec)
+{
+    ++trace.calls[rec->op];
+    if (rec->flags & TRACE_SAMPLED) trace.sampled = true;
+
+    uint64_t bytes = trace_op_bytes(rec->op, rec->count, rec->size);
+
+    if (rec->op == TRACE_FREE) {
+        if (!rec->in_ptr) return;
+
+        uint32_t slot = table_remove(rec->in_ptr);
+        if (slot == NO_SLOT) {
+            ++trace.unmatched;
+            return;
+        }
+
+        give_back_slot(slot);
+        add_step(TRACE_FREE, slot, 0, 0);
+        return;
+    }
+
+    if (trace_op_takes_pointer(rec->op) && rec->in_ptr) {
+        uint32_t slot = table_remove(rec->in_ptr);
+
+        if (slot == NO_SLOT) {
+            // Allocated before the trace started, or not sampled: the
+            // best we can do is treat it as new.
+            ++trace.unmatched;
+        } else if (rec->out_ptr) {
+            add_step(rec->op, slot, slot_sizes[slot], rec->size);
+            trace.current += rec->size - slot_sizes[slot];
+            trace.total   += rec->size;
+            slot_sizes[slot] = rec->size;
+            if (trace.current > trace.peak) trace.peak = trace.current;
+            table_insert(rec->out_ptr, slot);
+            return;
+        } else if (!rec->size || rec->op == TRACE_REALLOCF) {
+            // Freed, either by resizing to 0 or by reallocf(3) failing.
+            give_back_slot(slot);
+            add_step(TRACE_FREE, slot, 0, 0);
+            return;
+        } else {
+            // A failed realloc(3) leaves the block as it was.
+            table_insert(rec->in_ptr, slot);
+            return;
+        }
+    }
+
+    // A fresh allocation. If the trace says it failed, we still replay
+    // the request, but nothing will ever free it.
+    uint32_t slot = take_slot(rec->out_ptr ? bytes : 0);
+    uint8_t  op   = trace_op_takes_pointer(rec->op) ? TRACE_MALLOC : rec->op;
+    add_step(op, slot, rec->count, rec->size);
+
+    if (rec->out_ptr) {
+        // With threads, a block may be reused before its free is
+        // recorded; its old slot is then left to be freed at the end.
+        if (table_remove(rec->out_ptr) != NO_SLOT) ++trace.reused;
+        table_insert(rec->out_ptr, slot);
+    }
+}
+
+static void load_binary(FILE* in, char const* path,
+                        struct trace_file_header const* header)
+{
+    if (header->version != TRACE_VERSION) {
+        fprintf(stderr, "%s: %s: unsupported trace version %" PRIu32 "\n",
+                me, path, header->version);
+        exit(1);
+    }
+
+    struct trace_codec  codec = { .time_ns = header->start_ns };
+    struct trace_record rec;
+
+    while (trace_decode(&codec, in, &rec))
+        add_call(&rec);
+
+    trace_codec_destroy(&codec);
+
+    if (!feof(in)) {
+        fprintf(stderr, "%s: %s: malformed record\n", me, path);
+        exit(1);
+    }
+}
+
+static bool parse_pointer(char const* s, char** end, uint64_t* out)
+{
+    if (strncmp(s, "(nil)", 5) == 0) {
+        *end = (char*) s + 5;
+        *out = 0;
+        return true;
+    }
+
+    *out = strtoull(s, end, 16);
+    return *end != s;
+}
+
+static bool parse_number(char const* s, char** end, uint64_t* out)
+{
+    *out = strtoull(s, end, 10);
+    return *end != s;
+}
+
+// Parses one line of a text trace (perhaps from rt211_trace_decode -v)
+// into `rec`. Returns false for lines that aren't calls, such as
+// messages about refused allocations.
+static bool parse_line(char const* line, struct trace_record* rec,
+                       bool* lacks_result)
+{
+    static struct { char const* name; uint8_t op; } const ops[] = {
+        { "malloc(",        TRACE_MALLOC   },
+        { "calloc(",        TRACE_CALLOC   },
+        { "realloc(",       TRACE_REALLOC  },
+        { "reallocf(",      TRACE_REALLOCF },
+        { "free(",          TRACE_FREE     },
+        { "aligned_alloc(", TRACE_MEMALIGN },
+    };
+
+    if (*line == '[') {
+        line = strstr(line, "] ");
+        if (!line) return false;
+        line += 2;
+    }
+
+    memset(rec, 0, sizeof *rec);
+    rec->count  = 1;
+    rec->weight = 1;
+
+    size_t i = 0;
+    while (i < sizeof ops / sizeof *ops &&
+           strncmp(line, ops[i].name, strlen(ops[i].name)))
+        ++i;
+    if (i == sizeof ops / sizeof *ops) return false;
+
+    rec->op = ops[i].op;
+    char* p = (char*) line + strlen(ops[i].name);
+    bool  ok;
+
+    switch (rec->op) {
+    case TRACE_MALLOC:
+        ok = parse_number(p, &p, &rec->size);
+        break;
+
+    case TRACE_CALLOC:
+    case TRACE_MEMALIGN:
+        ok = parse_number(p, &p, &rec->count) && strncmp(p, ", ", 2) == 0 &&
+             parse_number(p + 2, &p, &rec->size);
+        break;
+
+    case TRACE_FREE:
+        ok = parse_pointer(p, &p, &rec->in_ptr);
+        break;
+
+    default:
+        ok = parse_pointer(p, &p, &rec->in_ptr) && strncmp(p, ", ", 2) == 0 &&
+             parse_number(p + 2, &p, &rec->size);
+        break;
+    }
+
+    if (!ok || *p++ != ')') return false;
+    if (rec->op == TRACE_FREE) return true;
+
+    if (strncmp(p, " = ", 3) || !parse_pointer(p + 3, &p, &rec->out_ptr)) {
+        *lacks_result = true;
+        return false;
+    }
+
+    if (strncmp(p, " weight=", 8) == 0) rec->flags |= TRACE_SAMPLED;
+    return true;
+}
+
+// Parses and adds each line in `text`, which may hold several.
+static void add_lines(char* text, bool* lacks_result)
+{
+    struct trace_record rec;
+
+    for (char* line = text; line && *line; ) {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = 0;
+
+        if (parse_line(line, &rec, lacks_result)) add_call(&rec);
+        line = next;
+    }
+}
+
+// `prefix` holds the first `prefix_len` bytes of the file, which we
+// already read looking for a binary header.
+static void load_text(FILE* in, char const* path,
+                      char const* prefix, size_t prefix_len)
+{
+    bool lacks_result = false;
+
+    // Finish the line that the prefix ends in, and take it from there.
+    char*   line = NULL;
+    size_t  size = 0;
+    ssize_t len  = prefix_len && prefix[prefix_len - 1] != '\n'
+                   ? getline(&line, &size, in) : 0;
+    size_t  rest = len < 0 ? 0 : (size_t) len;
+
+    char* first = xrealloc(NULL, prefix_len + rest + 1);
+    memcpy(first, prefix, prefix_len);
+    if (rest) memcpy(first + prefix_len, line, rest);
+    first[prefix_len + rest] = 0;
+
+    add_lines(first, &lacks_result);
+    free(first);
+
+    while (getline(&line, &size, in) >= 0)
+        add_lines(line, &lacks_result);
+
+    free(line);
+
+    if (lacks_result) {
+        fprintf(stderr, "%s: %s: trace lacks result pointers; record it "
+                        "again with this version of lib211\n", me, path);
+        exit(1);
+    }
+}
+
+static void load(char const* path)
+{
+    FILE* in = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!in) {
+        perror(path);
+        exit(1);
+    }
+
+    struct trace_file_header header;
+    size_t got = fread(&header, 1, sizeof header, in);
+
+    if (got == sizeof header &&
+            memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) == 0)
+        load_binary(in, path, &header);
+    else
+        load_text(in, path, (char const*) &header, got);
+
+    if (in != stdin) fclose(in);
+}
+
+///
+/// REPLAYING ON AN ALLOCATOR
+///
+
+struct allocator
+{
+    char const* name;
+    void* (*malloc)(size_t);
+    void* (*calloc)(size_t, size_t);
+    void* (*realloc)(void*, size_t);
+    void* (*aligned_alloc)(size_t, size_t);
+    void  (*free)(void*);
+};
+
+static void* libc_malloc(size_t n)            { return malloc(n); }
+static void* libc_calloc(size_t m, size_t n)  { return calloc(m, n); }
+static void* libc_realloc(void* p, size_t n)  { return realloc(p, n); }
+static void  libc_free(void* p)               { free(p); }
+
+static void* libc_aligned_alloc(size_t align, size_t n)
+{
+    void* p;
+    if (align < sizeof p) align = sizeof p;
+    return posix_memalign(&p, align, n) ? NULL : p;
+}
+
+static struct allocator libc_allocator = {
+    .name          = "C library",
+    .malloc        = libc_malloc,
+    .calloc        = libc_calloc,
+    .realloc       = libc_realloc,
+    .aligned_alloc = libc_aligned_alloc,
+    .free          = libc_free,
+};
+
+// Looks up PREFIX`name` in `lib`, or returns NULL.
+static void* find_function(void* lib, char const* prefix, char const* name)
+{
+    char symbol[256];
+    snprintf(symbol, sizeof symbol, "%s%s", prefix, name);
+
+    void* fn;
+    *(void**) &fn = dlsym(lib, symbol);
+    return fn;
+}
+
+static struct allocator load_allocator(char const* path, char const* prefix)
+{
+    void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) fail(dlerror());
+
+    struct allocator a = { .name = path };
+
+    // POSIX's workaround for converting from `void*`; see dlsym(3).
+    *(void**) &a.malloc        = find_function(lib, prefix, "malloc");
+    *(void**) &a.calloc        = find_function(lib, prefix, "calloc");
+    *(void**) &a.realloc       = find_function(lib, prefix, "realloc");
+    *(void**) &a.aligned_alloc = find_function(lib, prefix, "aligned_alloc");
+    *(void**) &a.free          = find_function(lib, prefix, "free");
+
+    if (!a.malloc || !a.free) {
+        fprintf(stderr, "%s: %s doesn't define %smalloc and %sfree\n",
+                me, path, prefix, prefix);
+        exit(1);
+    }
+
+    return a;
+}
+
+// Stand-ins for the optional functions, in terms of malloc and free.
+static void* fallback_calloc(struct allocator const* a, size_t m, size_t n)
+{
+    if (m && n > SIZE_MAX / m) return NULL;
+
+    void* p = a->malloc(m * n);
+    if (p) memset(p, 0, m * n);
+    return p;
+}
+
+static void* fallback_realloc(struct allocator const* a, void* p,
+                              size_t old_size, size_t n)
+{
+    void* q = a->malloc(n);
+    if (q && p) memcpy(q, p, old_size < n ? old_size : n);
+    if (q) a->free(p);
+    return q;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Runs the steps once on `a`, returning the nanoseconds they took.
+static double replay(struct allocator const* a, void** blocks,
+                     size_t* failures)
+{
+    double start = now_ns();
+
+    for (size_t i = 0; i < step_count; ++i) {
+        struct step const* s = &steps[i];
+        void* p;
+
+        switch (s->op) {
+        case TRACE_MALLOC:
+            p = blocks[s->slot] = a->malloc(s->size);
+            break;
+
+        case TRACE_CALLOC:
+            p = blocks[s->slot] = a->calloc
+                ? a->calloc(s->count, s->size)
+                : fallback_calloc(a, s->count, s->size);
+            break;
+
+        case TRACE_MEMALIGN:
+            p = blocks[s->slot] = a->aligned_alloc
+                ? a->aligned_alloc(s->count, s->size)
+                : a->malloc(s->size);
+            break;
+
+        case TRACE_REALLOC:
+        case TRACE_REALLOCF:
+            p = a->realloc
+                ? a->realloc(blocks[s->slot], s->size)
+                : fallback_realloc(a, blocks[s->slot], s->count, s->size);
+            if (p) blocks[s->slot] = p;
+            break;
+
+        default:
+            a->free(blocks[s->slot]);
+            blocks[s->slot] = NULL;
+            continue;
+        }
+
+        if (!p && s->size) ++*failures;
+    }
+
+    return now_ns() - start;
+}
+
+static void run_allocator(struct allocator const* a, unsigned repeat)
+{
+    void** blocks = calloc(slot_count ? slot_count : 1, sizeof *blocks);
+    if (!blocks) fail(strerror(errno));
+
+    double best = 0, sum = 0;
+    size_t failures = 0;
+
+    for (unsigned r = 0; r < repeat; ++r) {
+        double ns = replay(a, blocks, &failures);
+        sum += ns;
+        if (!r || ns < best) best = ns;
+
+        for (uint32_t i = 0; i < slot_count; ++i) {
+            a->free(blocks[i]);
+            blocks[i] = NULL;
+        }
+    }
+
+    free(blocks);
+
+    double per_call = step_count ? best / (double) step_count : 0;
+
+    printf("allocator:    %s\n", a->name);
+    printf("time:         %.3f ms (%.1f ns/call)", best / 1e6, per_call);
+    if (repeat > 1)
+        printf(", best of %u; mean %.3f ms", repeat, sum / repeat / 1e6);
+    printf("\n");
+    if (failures)
+        printf("failed:       %zu calls\n", failures / repeat);
+}
+
+///
+/// SIMULATING A LIMIT
+///
+
+static void simulate_limit(bool peak_limit, uint64_t limit)
+{
+    // Which slots hold a block that the limit let through, and how big.
+    bool*     live  = calloc(slot_count ? slot_count : 1, sizeof *live);
+    uint64_t* sizes = calloc(slot_count ? slot_count : 1, sizeof *sizes);
+    if (!live || !sizes) fail(strerror(errno));
+
+    uint64_t current = 0, peak = 0, total = 0;
+    size_t   denied = 0, first_denied = 0;
+    uint64_t first_denied_size = 0;
+    uint8_t  first_denied_op = 0;
+
+    for (size_t i = 0; i < step_count; ++i) {
+        struct step const* s = &steps[i];
+
+        if (s->op == TRACE_FREE) {
+            if (live[s->slot]) current -= sizes[s->slot];
+            live[s->slot] = false;
+            continue;
+        }
+
+        bool     resize = trace_op_takes_pointer(s->op);
+        uint64_t old    = resize && live[s->slot] ? sizes[s->slot] : 0;
+        uint64_t bytes  = trace_op_bytes(s->op, s->count, s->size);
+
+        // A resize is only charged for the growth under a peak limit,
+        // but in full under a total limit, as lib211 does.
+        bool ok = peak_limit ? current - old + bytes <= limit
+                             : total + bytes <= limit;
+
+        if (!ok) {
+            if (!denied++) {
+                first_denied      = i + 1;
+                first_denied_size = bytes;
+                first_denied_op   = s->op;
+            }
+
+            if (s->op == TRACE_REALLOCF && live[s->slot]) {
+                current -= old;
+                live[s->slot] = false;
+            }
+
+            continue;
+        }
+
+        current += bytes - old;
+        total   += bytes;
+        if (current > peak) peak = current;
+        sizes[s->slot] = bytes;
+        live[s->slot]  = true;
+    }
+
+    free(live);
+    free(sizes);
+
+    static char const* const names[] = {
+        [TRACE_MALLOC]   = "malloc",
+        [TRACE_CALLOC]   = "calloc",
+        [TRACE_REALLOC]  = "realloc",
+        [TRACE_REALLOCF] = "reallocf",
+        [TRACE_MEMALIGN] = "aligned_alloc",
+    };
+
+    printf("limit:        %s %" PRIu64 " bytes\n",
+           peak_limit ? "peak" : "total", limit);
+
+    if (denied) {
+        printf("denied:       %zu calls, first call %zu (%s of %" PRIu64
+               " bytes)\n", denied, first_denied, names[first_denied_op],
+               first_denied_size);
+    } else {
+        printf("denied:       none\n");
+    }
+
+    printf("under limit:  peak %" PRIu64 ", total %" PRIu64 " bytes\n",
+           peak, total);
+}
+
+///
+/// MAIN
+///
+
+static bool parse_size(char const* s, uint64_t* out)
+{
+    char* end;
+    errno = 0;
+    uint64_t n = strtoull(s, &end, 10);
+    if (end == s || errno) return false;
+
+    unsigned shift = 0;
+    switch (*end) {
+    case 'K': shift = 10; ++end; break;
+    case 'M': shift = 20; ++end; break;
+    case 'G': shift = 30; ++end; break;
+    }
+
+    if (*end || n > UINT64_MAX >> shift) return false;
+    *out = n << shift;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    char const* lib_path = NULL;
+    char const* prefix   = "";
+    unsigned    repeat   = 1;
+    int         limit_kind = 0;
+    uint64_t    limit    = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:r:l:t:")) != -1) {
+        switch (opt) {
+        case 'a': lib_path = optarg; break;
+        case 'p': prefix   = optarg; break;
+
+        case 'r':
+            repeat = (unsigned) strtoul(optarg, NULL, 10);
+            if (!repeat) usage();
+            break;
+
+        case 'l':
+        case 't':
+            if (limit_kind || !parse_size(optarg, &limit)) usage();
+            limit_kind = opt;
+            break;
+
+        default:
+            usage();
+        }
+    }
+
+    if (argc - optind > 1 || (limit_kind && lib_path)) usage();
+
+    load(optind < argc ? argv[optind] : "-");
+
+    size_t calls = 0;
+    for (size_t i = 0; i <= TRACE_MEMALIGN; ++i)
+        calls += trace.calls[i];
+
+    printf("calls:        %zu (%zu malloc, %zu calloc, %zu realloc, "
+           "%zu aligned_alloc, %zu free)\n",
+           calls,
+           trace.calls[TRACE_MALLOC], trace.calls[TRACE_CALLOC],
+           trace.calls[TRACE_REALLOC] + trace.calls[TRACE_REALLOCF],
+           trace.calls[TRACE_MEMALIGN], trace.calls[TRACE_FREE]);
+    printf("requested:    peak %" PRIu64 ", total %" PRIu64
+           ", never freed %" PRIu64 " bytes\n",
+           trace.peak, trace.total, trace.current);
+    printf("live blocks:  at most %" PRIu32 "\n", slot_count);
+
+    if (trace.sampled)
+        printf("note:         the trace is sampled\n");
+    if (trace.unmatched)
+        printf("note:         %zu calls on blocks from before the trace\n",
+               trace.unmatched);
+    if (trace.reused)
+        printf("note:         %zu blocks reused before their free was "
+               "recorded\n", trace.reused);
+
+    if (limit_kind) {
+        simulate_limit(limit_kind == 'l', limit);
+    } else if (lib_path) {
+        struct allocator a = load_allocator(lib_path, prefix);
+        run_allocator(&a, repeat);
+    } else {
+        run_allocator(&libc_allocator, repeat);
+    }
+
+    free(steps);
+    free(free_slots);
+    free(slot_sizes);
+    free(table);
+    return 0;
+}